@@ -0,0 +1,149 @@
+#include "AnalyticsSession.h"
+
+#include <dbm/dbm.hpp>
+#include <dbm/drivers/mysql/mysql_session.hpp>
+
+#include <algorithm>
+#include <optional>
+
+struct AnalyticsSession::Connection
+{
+    explicit Connection(std::shared_ptr<dbm::mysql_session> s)
+        : db(std::move(s))
+    {}
+
+    std::shared_ptr<dbm::mysql_session> db;
+    dbm::prepared_stmt energy {"CALL zelezarna.get_energy(?, ?, ?)", dbm::local<unsigned>(), dbm::local<time_t>(), dbm::local<time_t>()};
+    dbm::prepared_stmt production {"CALL zelezarna.get_production(?, ?, ?)", dbm::local<unsigned>(), dbm::local<time_t>(), dbm::local<time_t>()};
+};
+
+AnalyticsSession::AnalyticsSession(SessionFactory factory, unsigned run_id, std::string name)
+    : Object(std::move(name))
+    , factory_(std::move(factory))
+    , run_id_(run_id)
+{
+}
+
+AnalyticsSession::~AnalyticsSession()
+{
+    close();
+}
+
+void AnalyticsSession::selectEnergy(time_t from, time_t to, RowCallback const& cb)
+{
+    select(&Connection::energy, from, to, cb);
+}
+
+void AnalyticsSession::selectProduction(time_t from, time_t to, RowCallback const& cb)
+{
+    select(&Connection::production, from, to, cb);
+}
+
+void AnalyticsSession::close()
+{
+    std::lock_guard lock(mtx_);
+    if (conn_) {
+        try {
+            conn_->db->close();
+        }
+        catch (std::exception& e) {
+            log(warning) << "close failed : " << e.what();
+        }
+        conn_.reset();
+    }
+}
+
+AnalyticsSession::Statistics AnalyticsSession::statistics() const
+{
+    return {n_connects_, n_reconnects_, n_health_checks_, n_queries_, n_query_failures_};
+}
+
+void AnalyticsSession::select(dbm::prepared_stmt Connection::* stmt, time_t from, time_t to, RowCallback const& cb)
+{
+    std::lock_guard lock(mtx_);
+
+    // rows with time not after the last passed one are repeated by overlapping pages
+    // (energy pages include the neighbouring points)
+    constexpr size_t col_unixtime = 1;
+    std::optional<time_t> last;
+    time_t page = std::max<time_t>(page_interval_.count(), 1);
+
+    for (time_t page_from = from; ; page_from += page) {
+        time_t page_to = to - page_from > page ? page_from + page : to;
+
+        for (int attempt = 0; ; ++attempt) {
+            dbm::sql_rows rows;
+
+            // only database errors drop the connection, callback exceptions go to the caller
+            try {
+                ensureConnected();
+
+                auto& s = (*conn_).*stmt;
+                s.param(0)->set(run_id_);
+                s.param(1)->set(page_from);
+                s.param(2)->set(page_to);
+
+                n_queries_++;
+                // dbm buffers the result set of one page, rows are handed to the callback afterwards
+                rows = conn_->db->select(s);
+                last_used_ = std::chrono::steady_clock::now();
+            }
+            catch (std::exception& e) {
+                n_query_failures_++;
+                conn_.reset();
+
+                if (attempt > 0) {
+                    log(error) << "query failed : " << e.what();
+                    throw;
+                }
+
+                log(warning) << "query failed, reconnecting : " << e.what();
+                n_reconnects_++;
+                continue;
+            }
+
+            for (auto const& row : rows) {
+                auto t = row.at(col_unixtime).get<time_t>();
+                if (last && t <= *last)
+                    continue;
+                last = t;
+                cb(row);
+            }
+            break;
+        }
+
+        if (page_to >= to)
+            return;
+    }
+}
+
+void AnalyticsSession::ensureConnected()
+{
+    if (!conn_) {
+        connect();
+        return;
+    }
+
+    if (std::chrono::steady_clock::now() - last_used_ < health_check_interval_)
+        return;
+
+    n_health_checks_++;
+    try {
+        conn_->db->query("SELECT 1");
+        last_used_ = std::chrono::steady_clock::now();
+    }
+    catch (std::exception& e) {
+        log(warning) << "health check failed, reconnecting : " << e.what();
+        n_reconnects_++;
+        connect();
+    }
+}
+
+void AnalyticsSession::connect()
+{
+    conn_.reset();
+    conn_ = std::make_unique<Connection>(factory_());
+    last_used_ = std::chrono::steady_clock::now();
+    n_connects_++;
+    log(debug) << "connected session " << conn_->db.get();
+}
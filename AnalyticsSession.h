@@ -0,0 +1,82 @@
+#ifndef ZELEZARNA_ANALYTICSSESSION_H
+#define ZELEZARNA_ANALYTICSSESSION_H
+
+#include "Object.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace dbm {
+class mysql_session;
+class prepared_stmt;
+class sql_row;
+}
+
+// Long lived database session for kpi calculations.
+// Session is opened on first use and kept open, kpi data queries are prepared once per
+// connection. Session idle for longer than health check interval is checked with a ping
+// query before use. Broken connection is reopened and the query is retried once.
+// Queries are serialized. A range is fetched in pages of page interval (one procedure call
+// per page), so only the rows of one page are buffered before they are passed to the
+// callback. Exceptions of the callback leave the connection open.
+class AnalyticsSession : public Object
+{
+public:
+    using SessionFactory = std::function<std::shared_ptr<dbm::mysql_session>()>;
+    using RowCallback = std::function<void(dbm::sql_row const&)>;
+
+    // Queries data of simulation run run_id
+    explicit AnalyticsSession(SessionFactory factory, unsigned run_id = 0, std::string name = "AnalyticsSession");
+
+    ~AnalyticsSession() override;
+
+    // get_energy procedure rows
+    void selectEnergy(time_t from, time_t to, RowCallback const& cb);
+
+    // get_production procedure rows
+    void selectProduction(time_t from, time_t to, RowCallback const& cb);
+
+    void close();
+
+    void setHealthCheckInterval(std::chrono::seconds interval) { health_check_interval_ = interval; }
+
+    void setPageInterval(std::chrono::seconds interval) { page_interval_ = interval; }
+
+    struct Statistics
+    {
+        unsigned long connects;
+        unsigned long reconnects;
+        unsigned long health_checks;
+        unsigned long queries;
+        unsigned long query_failures;
+    };
+
+    Statistics statistics() const;
+
+private:
+    struct Connection;
+
+    void select(dbm::prepared_stmt Connection::* stmt, time_t from, time_t to, RowCallback const& cb);
+
+    void ensureConnected();
+
+    void connect();
+
+    SessionFactory factory_;
+    unsigned run_id_;
+    std::unique_ptr<Connection> conn_;
+    std::chrono::seconds health_check_interval_ {30};
+    std::chrono::seconds page_interval_ {6 * 3600};
+    std::chrono::steady_clock::time_point last_used_;
+    std::mutex mtx_;
+
+    std::atomic<unsigned long> n_connects_ {0};
+    std::atomic<unsigned long> n_reconnects_ {0};
+    std::atomic<unsigned long> n_health_checks_ {0};
+    std::atomic<unsigned long> n_queries_ {0};
+    std::atomic<unsigned long> n_query_failures_ {0};
+};
+
+#endif //ZELEZARNA_ANALYTICSSESSION_H
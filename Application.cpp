@@ -1,7 +1,10 @@
 #include "Application.h"
 #include "Daq.h"
-#include "KpiCalc.h"
+#include "EnergyDelta.h"
+#include "SimulationRun.h"
+#include "ThreadPool.h"
 #include "webserver/WebsocketDataBus.h"
+#include "webserver/WebsocketSession.h"
 #include "nlohmann/json.hpp"
 
 #include <dbm/drivers/mysql/mysql_session.hpp>
@@ -15,7 +18,22 @@ Application::Application()
 
 Application::~Application()
 {
-    TimeReference::instance().unregisterPingCallback(this);
+    if (recompute_thread_.joinable())
+        recompute_thread_.join();
+
+    // runs wait for their ticks in progress - executor must still be running
+    {
+        std::lock_guard lock(runs_mtx_);
+        runs_.clear();
+    }
+    default_run_.reset();
+
+    // finish queued work before members used by tasks are destroyed
+    if (control_)
+        control_->stop();
+    control_strand_.reset();
+    if (executor_)
+        executor_->stop();
 }
 
 Application& Application::instance()
@@ -28,11 +46,9 @@ void Application::init()
 {
     daq_production_ = std::make_unique<DaqProduction>();
     daq_energy_ = std::make_unique<DaqEnergy>();
-
-    auto minmax = std::minmax(daq_energy_->data().begin()->tp, daq_production_->data().begin()->tp);
-
-    tp_initial_ = minmax.second + 14 * 24h;
-    resetIterators();
+    executor_ = std::make_unique<ThreadPool>(options.worker_threads, "Executor");
+    control_ = std::make_unique<ThreadPool>(1, "Control");
+    control_strand_ = std::make_unique<Strand>(*control_);
 
     dbm::utils::debug_logger::writer = [](auto level, auto&& msg) {
         if (level == dbm::utils::debug_logger::level::Error) {
@@ -45,65 +61,311 @@ void Application::init()
 
     pool_.set_max_connections(10);
 
-    try {
-        cleanDatabase();
+    log(info) << "Energy delta kernel : " << energyDeltaKernelName();
+
+    default_run_ = std::make_shared<SimulationRun>(0, *daq_energy_, *daq_production_, *executor_);
+    runs_.emplace(0, default_run_);
+}
+
+bool Application::shutdown()
+{
+    if (shutting_down_.exchange(true))
+        return true;
+
+    auto t_begin = std::chrono::steady_clock::now();
+    auto deadline = t_begin + options.shutdown_timeout;
+    log(info) << "shutdown - draining in-flight work";
+
+    // queued control commands see shutting_down_ and return, the command in progress
+    // finishes within its own timeout
+    control_->stop();
+
+    std::vector<std::shared_ptr<SimulationRun>> runs;
+    {
+        std::lock_guard lock(runs_mtx_);
+        for (auto const& it : runs_)
+            runs.push_back(it.second);
+    }
+
+    // stop all clocks first so runs drain in parallel
+    for (auto& run : runs)
+        run->stop();
+
+    bool drained = true;
+    for (auto& run : runs)
+        drained = run->drain(deadline) && drained;
+
+    {
+        std::unique_lock lock(recompute_mtx_);
+        if (!recompute_cv_.wait_until(lock, deadline, [this] { return !recompute_running_; })) {
+            log(error) << "recompute still running";
+            drained = false;
+        }
+        else if (recompute_thread_.joinable()) {
+            recompute_thread_.join();
+        }
     }
-    catch (std::exception&) {
-        throw;
+
+    storeKpiResults();
+
+    if (!drained) {
+        log(error) << "shutdown timeout after " << options.shutdown_timeout.count() << " sec";
+        return false;
+    }
+
+    // analytics sessions and strands of the runs are released before the executor stops
+    runs.clear();
+    {
+        std::lock_guard lock(runs_mtx_);
+        runs_.clear();
+        default_run_.reset();
     }
+    executor_->stop();
 
-    TimeReference::instance().registerPingCallback(this, std::bind(&Application::onTimePing, this, std::placeholders::_1));
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_begin).count();
+    log(info) << "shutdown finished in " << ms << " msec";
+    return true;
+}
+
+std::shared_ptr<SimulationRun> Application::run(unsigned id) const
+{
+    std::lock_guard lock(runs_mtx_);
+    auto it = runs_.find(id);
+    if (it == runs_.end())
+        throw std::runtime_error("simulation run " + std::to_string(id) + " not found");
+    return it->second;
+}
+
+unsigned Application::createRun()
+{
+    std::lock_guard lock(runs_mtx_);
+    if (runs_.size() >= options.max_runs)
+        throw std::runtime_error("max number of simulation runs reached");
+
+    unsigned id = next_run_id_++;
+    auto run = std::make_shared<SimulationRun>(id, *daq_energy_, *daq_production_, *executor_);
+    run->timeReference().setSpeed(default_run_->timeReference().speed());
+    runs_.emplace(id, std::move(run));
+    return id;
+}
+
+void Application::closeRun(unsigned id)
+{
+    if (id == 0)
+        throw std::runtime_error("default simulation run cannot be closed");
+
+    std::shared_ptr<SimulationRun> closed;
+    {
+        std::lock_guard lock(runs_mtx_);
+        auto it = runs_.find(id);
+        if (it == runs_.end())
+            throw std::runtime_error("simulation run " + std::to_string(id) + " not found");
+        closed = std::move(it->second);
+        runs_.erase(it);
+    }
+
+    // drain outside the lock, partition can be dropped only after inserts of ticks in progress
+    if (!closed->drain(std::chrono::steady_clock::now() + options.shutdown_timeout)) {
+        log(error) << "run " << id << " storage not dropped, ticks still in progress";
+    }
+    else {
+        try {
+            // DROP PARTITION holds the table metadata lock, inserts of other runs wait for it
+            auto conn = pool_.acquire();
+            run_storage_.drop(conn.get(), id);
+        }
+        catch (std::exception& e) {
+            log(error) << "clean database run " << id << " failed : " << e.what();
+        }
+    }
+
+    // messages of ticks in progress are published until the run is destroyed
+    closed.reset();
+    WebsocketDataBus::instance().forgetRun(id);
 }
 
 void Application::cleanDatabase()
 {
     auto conn = pool_.acquire();
-    conn.get().query("DELETE FROM energy_data");
-    conn.get().query("DELETE FROM production_data");
+    run_storage_.resetAll(conn.get());
+
+    std::lock_guard lock(runs_mtx_);
+    for (auto& it : runs_)
+        it.second->kpiCache().clear();
 }
 
-void Application::acceptMessage(std::string&& msg)
+void Application::loadKpiResults()
 {
-    auto& timeref = TimeReference::instance();
+    auto conn = pool_.acquire();
+    kpi_results_.load(conn.get());
+
+    unsigned next_id = kpi_results_.maxCalculationId() + 1;
+    if (next_calculation_id_ < next_id)
+        next_calculation_id_ = next_id;
+
+    // stored results of runs of earlier processes are kept apart from new runs
+    std::lock_guard lock(runs_mtx_);
+    next_run_id_ = std::max(next_run_id_, kpi_results_.maxRunId() + 1);
+}
+
+size_t Application::recompute(unsigned run_id, TimePoint from, TimePoint to, KpiRecompute::Source source,
+                              KpiRecompute::ResultCallback const& cb)
+{
+    if (recompute_running_.exchange(true))
+        throw std::runtime_error("recompute already running");
+
+    return runRecompute(run_id, from, to, source, cb);
+}
+
+void Application::startRecompute(unsigned run_id, TimePoint from, TimePoint to, KpiRecompute::Source source)
+{
+    // data of runs of earlier processes is removed on startup (cleanDatabase)
+    run(run_id);
+
+    std::lock_guard lock(recompute_mtx_);
+    if (recompute_running_.exchange(true))
+        throw std::runtime_error("recompute already running");
+
+    // previous recompute is finished, its thread only returns
+    if (recompute_thread_.joinable())
+        recompute_thread_.join();
+
+    recompute_thread_ = std::thread([this, run_id, from, to, source] {
+        try {
+            runRecompute(run_id, from, to, source, {});
+        }
+        catch (std::exception& e) {
+            log(error) << "recompute failed : " << e.what();
+        }
+    });
+}
+
+size_t Application::runRecompute(unsigned run_id, TimePoint from, TimePoint to, KpiRecompute::Source source,
+                                 KpiRecompute::ResultCallback const& cb)
+{
+    Finally finally([this] {
+        std::lock_guard lock(recompute_mtx_);
+        recompute_running_ = false;
+        recompute_cv_.notify_all();
+    });
+
+    // the run is kept alive while its cache is used
+    std::shared_ptr<SimulationRun> sim;
+    {
+        std::lock_guard lock(runs_mtx_);
+        if (auto it = runs_.find(run_id); it != runs_.end())
+            sim = it->second;
+    }
+    KpiCache private_cache;
+    KpiCache& cache = sim ? sim->kpiCache() : private_cache;
+
+    unsigned calc_id = next_calculation_id_++;
+
+    size_t n = KpiRecompute(*daq_energy_, *daq_production_).run(run_id, from, to, source, cache, *executor_,
+        [&](KpiRecompute::Result const& res) {
+            if (cb)
+                cb(res);
+
+            kpi_results_.add({
+                res.weekly ? KpiResults::Window::weekly : KpiResults::Window::daily,
+                res.time,
+                res.value,
+                calc_id,
+                run_id
+            });
+
+            WebsocketDataBus::instance().messageToWebclients(nlohmann::json {
+                    {res.weekly ? "kpi_weekly" : "kpi_daily", {
+                            { "time", ClockType::to_time_t(res.time) },
+                            { "value", res.value },
+                            { "calc_id", calc_id }
+                    }},
+                    { "run_id", run_id }
+            });
+        });
+
+    storeKpiResults();
+
+    return n;
+}
 
+std::pair<TimePoint, TimePoint> Application::dataTimeRange() const
+{
+    if (daq_energy_->data().empty() || daq_production_->data().empty())
+        throw std::runtime_error("no data");
+
+    return {
+        std::max(daq_energy_->data().front().tp, daq_production_->data().front().tp),
+        std::min(daq_energy_->data().back().tp, daq_production_->data().back().tp)
+    };
+}
+
+void Application::acceptMessage(std::string&& msg, WebsocketSession* origin)
+{
     try {
+        if (shutting_down_)
+            throw std::runtime_error("shutting down");
+
         auto j = nlohmann::json::parse(msg);
 
         if (j.find("command") != j.end()) {
             auto cmd = j["command"];
             auto type = cmd["type"];
 
-            if (type == "start") {
-                resetIterators();
-                timeref.stop();
-                try {
-                    cleanDatabase();
-                }
-                catch (std::exception&) {
-                    log(error) << "Clean database failed";
-                }
+            if (type == "recompute") {
+                auto range = dataTimeRange();
+                if (cmd.contains("from"))
+                    range.first = ClockType::from_time_t(cmd["from"].get<time_t>());
+                if (cmd.contains("to"))
+                    range.second = ClockType::from_time_t(cmd["to"].get<time_t>());
+                auto source = KpiRecompute::sourceFromString(cmd.value("source", "memory"));
 
-                static unsigned calc_id = 0;
-                calculation_id_ = calc_id++;
-                timeref.start(tp_initial_);
+                startRecompute(cmd.value("run_id", 0u), range.first, range.second, source);
             }
-            else if (type == "stop") {
-                timeref.stop();
+            else if (type == "kpi_history") {
+                auto from = cmd.contains("from") ? ClockType::from_time_t(cmd["from"].get<time_t>()) : TimePoint {};
+                auto to = cmd.contains("to") ? ClockType::from_time_t(cmd["to"].get<time_t>()) : TimePoint::max();
+                // stored results, or recalculated from database data (served from the run kpi cache)
+                if (cmd.value("source", "stored") == "database")
+                    run(cmd.value("run_id", 0u))->sendKpiHistoryMessage(from, to);
+                else
+                    sendKpiHistoryMessage(cmd.value("run_id", 0u), from, to);
             }
-            else if (type == "pause") {
-                timeref.pause(true);
+            else if (type == "create_run") {
+                run(createRun())->onSimulationChanged();
+                sendRunsMessage();
             }
-            else if (type == "resume") {
-                timeref.pause(false);
+            else if (type == "close_run") {
+                auto id = cmd.at("run_id").get<unsigned>();
+                postControlCommand(cmd, origin, [this, id] {
+                    closeRun(id);
+                    sendRunsMessage();
+                });
             }
-            else if (type == "speed") {
-                timeref.setSpeed(cmd.at("value").get<unsigned>());
+            else if (type == "list_runs") {
+                sendRunsMessage();
             }
             else if (type == "reset_statistics") {
-                resetStatistics();
+                pool_.reset_heartbeats_counter();
+                WebsocketDataBus::instance().resetStatistics();
+                run(cmd.value("run_id", 0u))->resetStatistics();
             }
             else if (type == "get_statistics") {
-                sendStatisticsMessage();
+                sendStatisticsMessage(*run(cmd.value("run_id", 0u)));
+            }
+            else if (type == "subscribe" || type == "unsubscribe") {
+                if (!origin)
+                    throw std::runtime_error("subscribe requires websocket session");
+
+                std::vector<Topic> topics;
+                for (auto const& it : cmd.at("topics"))
+                    topics.push_back(WebsocketDataBus::topicFromString(it.get<std::string>()));
+                WebsocketDataBus::instance().subscribe(origin, topics, type == "subscribe");
+            }
+            else if (type == "encoding") {
+                if (!origin)
+                    throw std::runtime_error("encoding requires websocket session");
+                WebsocketDataBus::instance().setEncoding(origin, WebsocketDataBus::encodingFromString(cmd.at("value").get<std::string>()));
             }
             else if (type == "global_logging_level") {
                 Log::setGlobalLoggingLevel(cmd.at("level").get<std::string>());
@@ -113,6 +375,19 @@ void Application::acceptMessage(std::string&& msg)
                         cmd.at("channel").get<std::string>(),
                         cmd.at("level").get<std::string>());
             }
+            else {
+                // simulation commands address a run (default run if not specified)
+                auto sim = run(cmd.value("run_id", 0u));
+                if (type == "start" || type == "stop") {
+                    // wait for ticks in progress
+                    postControlCommand(cmd, origin, [sim, cmd] {
+                        sim->acceptCommand(cmd);
+                    });
+                }
+                else {
+                    sim->acceptCommand(cmd);
+                }
+            }
         }
         else {
             throw std::runtime_error("Command not recognized");
@@ -123,25 +398,69 @@ void Application::acceptMessage(std::string&& msg)
     }
 }
 
-void Application::onSimulationChanged() const
+void Application::postControlCommand(nlohmann::json const& cmd, WebsocketSession* origin, std::function<void()>&& task)
 {
-    WebsocketDataBus::instance().messageToWebclients(statusMessage());
+    std::weak_ptr<WebsocketSession> cli;
+    if (origin)
+        cli = origin->weak_from_this();
+
+    control_strand_->post([this, cmd, cli, task = std::move(task)] {
+        nlohmann::json result {
+                { "type", cmd["type"] },
+                { "ok", true }
+        };
+        if (cmd.contains("run_id"))
+            result["run_id"] = cmd["run_id"];
+
+        try {
+            if (shutting_down_)
+                throw std::runtime_error("shutting down");
+            task();
+        }
+        catch (std::exception& e) {
+            log(error) << "command " << cmd.dump() << " failed : " << e.what();
+            result["ok"] = false;
+            result["error"] = e.what();
+        }
+
+        if (auto session = cli.lock())
+            WebsocketDataBus::instance().messageToSession(*session, nlohmann::json {{ "command_result", std::move(result) }});
+    });
 }
 
 std::string Application::statusMessage() const
 {
-    auto& timeref = TimeReference::instance();
-    nlohmann::json j;
-    j["sim_time"] = timeref.simulatorCurrentUnixtime();
-    j["sim_status"] = timeref.status();
-    j["sim_speed"] = timeref.speed();
+    std::shared_ptr<SimulationRun> run;
+    {
+        std::lock_guard lock(runs_mtx_);
+        run = default_run_;
+    }
+
+    if (!run)
+        throw std::runtime_error("application shut down");
+    return run->statusMessage().dump();
+}
+
+void Application::sendRunsMessage() const
+{
+    nlohmann::json runs = nlohmann::json::array();
+    {
+        std::lock_guard lock(runs_mtx_);
+        for (auto const& it : runs_) {
+            auto& timeref = it.second->timeReference();
+            runs.push_back({
+                { "run_id", it.first },
+                { "sim_status", timeref.status() },
+                { "sim_time", timeref.simulatorCurrentUnixtime() }
+            });
+        }
+    }
 
-    return j.dump(4);
+    WebsocketDataBus::instance().messageToWebclients(nlohmann::json {{"runs", std::move(runs)}});
 }
 
-void Application::sendStatisticsMessage() const
+void Application::sendStatisticsMessage(SimulationRun const& run) const
 {    
-    auto statistics = operation_statistics_; // make a copy
     auto pool_stat = pool_.stat();
 
     nlohmann::json profile = nlohmann::json::array();
@@ -150,6 +469,8 @@ void Application::sendStatisticsMessage() const
     }
 
     nlohmann::json json;
+    json["run_id"] = run.id();
+    json["operation_statistics"] = run.statistics();
     json["operation_statistics"]["pool"] = {
             { "n_conn", pool_stat.n_conn },
             { "n_active_conn", pool_stat.n_active_conn },
@@ -163,127 +484,80 @@ void Application::sendStatisticsMessage() const
             { "acquire_profile", std::move(profile)}
     };
 
-    json["operation_statistics"]["daq"] = nlohmann::json::array();
-
-    for (auto const& stat : statistics) {
-        nlohmann::json node;
-        node["item_name"] = stat.first;
-        node["operations_count"] = stat.second.operations_count;
-        node["processing_exception_count"] = stat.second.processing_exception_count;
-        node["acquire_db_session_count"] = stat.second.acquire_db_session_count;
-        node["acquire_db_session_failed_count"] = stat.second.acquire_db_session_failed_count;
-        node["prepared_stmt_reuse_count"] = stat.second.prepared_stmt_reuse_count;
-        node["records_to_write_count"] = stat.second.records_to_write_count;
-        node["records_write_count"] = stat.second.records_write_count;
-        node["records_write_failed_count"] = stat.second.records_write_failed_count;
-        json["operation_statistics"]["daq"].push_back(std::move(node));
-    }
+    auto ws_stat = WebsocketDataBus::instance().statistics();
+    json["operation_statistics"]["websocket"] = {
+            { "sessions", ws_stat.sessions },
+            { "messages", ws_stat.messages },
+            { "payload_bytes", ws_stat.payload_bytes },
+            { "wire_bytes", ws_stat.wire_bytes },
+            { "compression_ratio", ws_stat.compression_ratio },
+            { "compress_cpu_ms", ws_stat.compress_cpu_ms },
+            { "dropped_sessions", ws_stat.dropped_sessions }
+    };
 
-    WebsocketDataBus::instance().messageToWebclients(std::move(json));
+    // pool, session and database internals are for admin sessions only
+    WebsocketDataBus::instance().messageToWebclients(std::move(json), true);
 }
 
-void Application::onTimePing(TimePoint tp)
+void Application::sendKpiHistoryMessage(unsigned run_id, TimePoint from, TimePoint to) const
 {
-    std::thread([this, tp] {
-
-        WebsocketDataBus::instance().messageToWebclients(nlohmann::json{
-            {"sim_time", ClockType::to_time_t(tp)},
-            {"calc_id", calculation_id_}
-        });
-
-        auto thr1 = std::thread([this, tp] {
-            daq_energy_->pingSlot(tp);
-        });
-
-        auto thr2 = std::thread([this, tp] {
-            daq_production_->pingSlot(tp);
-        });
-
-        thr1.join();
-        thr2.join();
-
-        if (tp >= tp_kpi_next_) {
-            //auto db = pool_.acquire(); // get session from pool
-            //Finally finally([&] {
-            //    db.get().close(); // TODO: if not closed prepared statements from another threads may fail
-            //});
-
-            auto db = makeDbSession(); // session not from pool
-
-            try {
-                double kpi = KpiCalc().calculateDaily(tp_kpi_next_, *db);
-
-                WebsocketDataBus::instance().messageToWebclients(nlohmann::json {
-                        {"kpi_daily", {
-                                { "time", ClockType::to_time_t(tp) },
-                                { "value", kpi },
-                                { "calc_id", calculation_id_ }
-                        }
-                        }});
-            }
-            catch (std::exception& e) {
-                log(error) << "kpi calculate daily failed : " << e.what();
-            }
-
-            time_t utime = ClockType::to_time_t(tp_kpi_next_);
-            struct tm timeinfo = {};
-            gmtime_r(&utime, &timeinfo);
-
-            if (timeinfo.tm_wday == 0) {
-                // every sunday
-                try {
-                    double kpi = KpiCalc().calculateWeekly(tp_kpi_next_, *db);
-
-                    WebsocketDataBus::instance().messageToWebclients(nlohmann::json {
-                            {"kpi_weekly", {
-                                    { "time", ClockType::to_time_t(tp) },
-                                    { "value", kpi },
-                                    { "calc_id", calculation_id_ }
-                            }
-                            }});
-                }
-                catch (std::exception& e) {
-                    log(error) << "kpi calculate weekly failed : " << e.what();
-                }
-            }
-
-            tp_kpi_last_ = tp_kpi_next_;
-            tp_kpi_next_ += 24h;
+    nlohmann::json j;
+    j["run_id"] = run_id;
+
+    for (auto window : { KpiResults::Window::daily, KpiResults::Window::weekly }) {
+        auto& node = j["kpi_history"][std::string(KpiResults::windowToString(window))];
+        node = nlohmann::json::array();
+        for (auto const& it : kpi_results_.history(run_id, window, from, to)) {
+            node.push_back({
+                { "time", ClockType::to_time_t(it.end) },
+                { "value", it.value },
+                { "calc_id", it.calc_id }
+            });
         }
+    }
 
-    }).detach();
+    WebsocketDataBus::instance().messageToWebclients(std::move(j));
 }
 
-void Application::resetIterators()
+void Application::storeKpiResults()
 {
-    resetStatistics();
+    try {
+        auto conn = pool_.acquire();
+        kpi_results_.flush(conn.get());
+    }
+    catch (std::exception& e) {
+        log(error) << "store kpi results failed : " << e.what();
+    }
 
-    daq_energy_->resetIterator(tp_initial_);
-    daq_production_->resetIterator(tp_initial_);
+    if (auto n = kpi_results_.pendingCount(); n > 0) {
+        log(warning) << n << " kpi results not stored yet";
+    }
+}
 
-    tp_kpi_last_ = {};
+void Application::scheduleKpiFlush()
+{
+    if (kpi_flush_scheduled_)
+        return;
 
-    time_t utime = ClockType::to_time_t(tp_initial_);
-    struct tm timeinfo = {};
-    gmtime_r(&utime, &timeinfo);
-    timeinfo.tm_hour = 6;
-    timeinfo.tm_min = 0;
-    timeinfo.tm_sec = 0;
-    timeinfo.tm_isdst = -1;
-    utime = mktime(&timeinfo);
-    utime += timeinfo.tm_gmtoff;
-    tp_kpi_next_ = ClockType::from_time_t(utime);
+    auto pending = kpi_results_.pendingCount();
+    if (pending == 0)
+        return;
 
-    log(debug) << "Next kpi calculation time " << TimeReference::timeStamp(tp_kpi_next_);
-}
+    auto now = std::chrono::steady_clock::now();
+    if (pending < KpiResults::max_batch_size && now - kpi_flushed_.load() < KpiResults::flush_interval)
+        return;
 
-void Application::resetStatistics()
-{
-    pool_.reset_heartbeats_counter();
+    if (kpi_flush_scheduled_.exchange(true))
+        return;
 
-    for (auto& it : operation_statistics_) {
-        it.second.reset();
-    }
+    bool submitted = executor_->submit([this] {
+        storeKpiResults();
+        kpi_flushed_ = std::chrono::steady_clock::now();
+        kpi_flush_scheduled_ = false;
+    });
+
+    if (!submitted)
+        kpi_flush_scheduled_ = false;
 }
 
 std::shared_ptr<dbm::mysql_session> Application::makeDbSession() const
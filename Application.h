@@ -4,14 +4,25 @@
 #include "Object.h"
 #include "common.h"
 #include "TimeReference.h"
+#include "KpiRecompute.h"
+#include "KpiResults.h"
+#include "RunStorage.h"
+#include "nlohmann/json_fwd.hpp"
 
 #include <dbm/dbm.hpp>
 #include <dbm/drivers/mysql/mysql_session.hpp>
 
+#include <condition_variable>
 #include <map>
 #include <mutex>
+#include <thread>
 
-class Daq;
+class DaqEnergy;
+class DaqProduction;
+class SimulationRun;
+class Strand;
+class ThreadPool;
+class WebsocketSession;
 
 class Application : public Object
 {
@@ -42,21 +53,68 @@ public:
 
     void init();
 
+    // Drains in-flight work before exit: stops the clocks of all runs, waits for ticks in progress
+    // and recompute, stores kpi results, closes the runs and stops the executor.
+    // Returns false if work is still running after options.shutdown_timeout (nothing is closed then).
+    bool shutdown();
+
     auto& pool() { return pool_; }
 
+    // Shared worker pool for tick processing, inserts and kpi calculations
+    ThreadPool& executor() { return *executor_; }
+
+    // Deletes data of all runs
     void cleanDatabase();
 
-    void acceptMessage(std::string&& msg);
+    // Preload stored kpi results into cache, new run ids continue after the stored ones
+    void loadKpiResults();
+
+    // Recalculate kpi of the run for the history range and stream results to webclients (blocking).
+    // A run that doesn't exist in this process (database source before the database is cleaned,
+    // recompute mode) is recomputed with a private kpi cache.
+    size_t recompute(unsigned run_id, TimePoint from, TimePoint to, KpiRecompute::Source source,
+                     KpiRecompute::ResultCallback const& cb = {});
+
+    // Runs recompute of an existing run in the background (thread joined by the next start or shutdown)
+    void startRecompute(unsigned run_id, TimePoint from, TimePoint to, KpiRecompute::Source source);
 
-    void onSimulationChanged() const;
+    // Time range covered by both energy and production data
+    std::pair<TimePoint, TimePoint> dataTimeRange() const;
 
+    // Websocket command, origin - session of the client that sent it (session scoped commands)
+    void acceptMessage(std::string&& msg, WebsocketSession* origin = nullptr);
+
+    // Status of the default run
     std::string statusMessage() const;
 
     std::unique_lock<std::shared_mutex> dbLockUnique() { return std::unique_lock(db_mtx_); }
 
     std::shared_lock<std::shared_mutex> dbLockShared() { return std::shared_lock(db_mtx_); }
 
-    auto& operationStatistics(std::string const& key) { return operation_statistics_[key]; }
+    auto& kpiResults() { return kpi_results_; }
+
+    auto& runStorage() { return run_storage_; }
+
+    // Flushes pending kpi results (blocking)
+    void storeKpiResults();
+
+    // Flushes pending kpi results on the executor when a batch is full or the oldest result
+    // waits longer than the flush interval (called per tick, final flush on stop / shutdown)
+    void scheduleKpiFlush();
+
+    unsigned nextCalculationId() { return next_calculation_id_++; }
+
+    // Default simulation run (run id 0), always present
+    SimulationRun& defaultRun() { return *default_run_; }
+
+    // Throws if run does not exist
+    std::shared_ptr<SimulationRun> run(unsigned id) const;
+
+    // Creates a new isolated simulation run, returns its id
+    unsigned createRun();
+
+    // Stops and removes the run (default run cannot be closed)
+    void closeRun(unsigned id);
 
     struct Options
     {
@@ -64,32 +122,55 @@ public:
         std::string db_password;
         std::string db_hostname {"127.0.0.1"};
         int db_port {3306};
+        unsigned worker_threads {4};    // executor size (0 - hardware concurrency)
+        unsigned max_runs {8};          // max concurrent simulation runs
+        std::chrono::seconds shutdown_timeout {10}; // max time to drain in-flight work on stop / shutdown
     } options;
 
+    std::shared_ptr<dbm::mysql_session> makeDbSession() const;
+
 private:
 
-    void sendStatisticsMessage() const;
+    // Operation statistics of the run (admin sessions only)
+    void sendStatisticsMessage(SimulationRun const& run) const;
 
-    void onTimePing(TimePoint tp);
+    void sendKpiHistoryMessage(unsigned run_id, TimePoint from, TimePoint to) const;
 
-    void resetIterators();
+    void sendRunsMessage() const;
 
-    void resetStatistics();
+    // recompute_running_ already set by the caller, reset when finished
+    size_t runRecompute(unsigned run_id, TimePoint from, TimePoint to, KpiRecompute::Source source,
+                        KpiRecompute::ResultCallback const& cb);
 
-    std::shared_ptr<dbm::mysql_session> makeDbSession() const;
+    // Runs a command waiting for ticks in progress (start, stop, close_run) off the io threads.
+    // Commands run one at a time in arrival order, the origin session receives command_result.
+    void postControlCommand(nlohmann::json const& cmd, WebsocketSession* origin, std::function<void()>&& task);
 
-    std::unique_ptr<Daq> daq_production_;
-    std::unique_ptr<Daq> daq_energy_;
+    std::unique_ptr<DaqEnergy> daq_energy_;         // data source shared by runs
+    std::unique_ptr<DaqProduction> daq_production_;
+    std::unique_ptr<ThreadPool> executor_;
+    std::unique_ptr<ThreadPool> control_;           // blocking run lifecycle commands
+    std::unique_ptr<Strand> control_strand_;
 
     Pool pool_;
 
     std::shared_mutex db_mtx_;
-    TimePoint tp_initial_;
-    TimePoint tp_kpi_last_; // time of the last kpi calculation
-    TimePoint tp_kpi_next_; // time of the next kpi calculation
 
-    unsigned calculation_id_ {0};
-    std::map<std::string, OpearationStatistics> operation_statistics_;
+    std::map<unsigned, std::shared_ptr<SimulationRun>> runs_;
+    std::shared_ptr<SimulationRun> default_run_;
+    unsigned next_run_id_ {1};
+    std::mutex mutable runs_mtx_;
+
+    std::atomic<unsigned> next_calculation_id_ {0};
+    std::atomic<bool> recompute_running_ {false};
+    std::mutex recompute_mtx_;
+    std::condition_variable recompute_cv_;
+    std::thread recompute_thread_;
+    std::atomic<bool> shutting_down_ {false};
+    std::atomic<bool> kpi_flush_scheduled_ {false};
+    std::atomic<std::chrono::steady_clock::time_point> kpi_flushed_ {};
+    KpiResults kpi_results_;
+    RunStorage run_storage_;
 };
 
 #endif //ZELEZARNA_APPLICATION_H
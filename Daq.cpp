@@ -1,6 +1,9 @@
 #include "Daq.h"
 #include "TimeReference.h"
 #include "Application.h"
+#include "SimulationRun.h"
+#include "webserver/WebsocketDataBus.h"
+#include "nlohmann/json.hpp"
 
 #include <dbm/dbm.hpp>
 
@@ -55,42 +58,58 @@ void query_helper(dbm::prepared_stmt& stmt, dbm::mysql_session& db, OpearationSt
 
 Daq::Daq(std::string name)
     : Object(std::move(name))
+    , data_(std::make_shared<std::vector<Data> const>())
 {
+    iterator_ = data_->begin();
 }
 
-void Daq::pingSlot(TimePoint tp)
+Daq::Daq(Daq const& source, SimulationRun& run)
+    : Object(source.name())
+    , data_(source.data_)
+    , iterator_(source.data_->begin())
+    , run_(&run)
+{
+}
+
+size_t Daq::pingSlot(TimePoint tp)
 {
     try {
         std::vector<Data> pts;
 
         log(trace) << "pingSlot " << this;
 
-        while (tp >= iterator_->tp && iterator_ != data_.end()) {
+        while (tp >= iterator_->tp && iterator_ != data_->end()) {
             log(trace) << "Trigger sim time : " << TimeReference::timeStamp(tp) << " data time : "
                        << TimeReference::timeStamp(iterator_->tp);
             pts.push_back(*iterator_);
             ++iterator_;
         }
 
-        if (!pts.empty())
+        if (!pts.empty()) {
             insertData(pts);
+            publishSeries(pts);
+        }
+
+        return pts.size();
     }
     catch (std::exception& e) {
         log(error) << "pingSlot exception : " << e.what();
     }
+
+    return 0;
 }
 
 void Daq::resetIterator(TimePoint tp)
 {
     log(info) << "initializing iterator to " << TimeReference::timeStamp(tp);
 
-    iterator_ = data_.begin();
+    iterator_ = data_->begin();
 
-    while (tp > iterator_->tp && iterator_ != data_.end()) {
+    while (tp > iterator_->tp && iterator_ != data_->end()) {
         ++iterator_;
     }
 
-    if (iterator_ != data_.end()) {
+    if (iterator_ != data_->end()) {
         log(debug) << "iterator initialized to " << TimeReference::timeStamp(iterator_->tp);
     }
     else {
@@ -108,7 +127,6 @@ TimePoint Daq::iteratorTimePoint() const
 
 void Daq::getData()
 {
-    data_.clear();
 
     // Open file
     std::string filename("data/KpiData.txt");
@@ -159,19 +177,55 @@ void Daq::getData()
     }
 
     // data reverse
-    data_.reserve(data_tmp.size());
-    std::copy(data_tmp.rbegin(), data_tmp.rend(), std::back_inserter(data_));
+    auto data = std::make_shared<std::vector<Data>>();
+    data->reserve(data_tmp.size());
+    std::copy(data_tmp.rbegin(), data_tmp.rend(), std::back_inserter(*data));
+    data_ = std::move(data);
 
     // initialize iterator
-    iterator_ = data_.begin();
+    iterator_ = data_->begin();
+}
+
+void Daq::publishSeries(std::vector<Data> const& pts) const
+{
+    auto topic = type() == DaqType::energy ? Topic::series_energy : Topic::series_production;
+    if (!run_ || !WebsocketDataBus::instance().hasSubscribers(topic))
+        return;
+
+    nlohmann::json values = nlohmann::json::array();
+    for (auto const& it : pts) {
+        values.push_back({
+            ClockType::to_time_t(it.tp),
+            it.is_null ? nlohmann::json() : nlohmann::json(it.val)
+        });
+    }
+
+    run_->messageToWebclients(nlohmann::json {
+            {WebsocketDataBus::topicToString(topic), {
+                    { "values", std::move(values) }
+            }
+            }});
 }
 
 void Daq::insertData(std::vector<Data> const& pts) noexcept
 {
-    auto &stat = Application::instance().operationStatistics(name());
+    if (!run_) {
+        log(error) << "insert data failed : daq not attached to simulation run";
+        return;
+    }
+
+    auto &stat = run_->operationStatistics(name());
     stat.operations_count++;
     stat.records_to_write_count += pts.size();
 
+    // Report pipeline latencies to the speed governor (also for failed inserts)
+    auto t_start = std::chrono::steady_clock::now();
+    double acquire_ms = 0;
+    Finally report_latency([&] {
+        double insert_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+        run_->speedGovernor().recordInsert(insert_ms, acquire_ms);
+    });
+
     try {
 #ifdef RANDOM_SLEEP_TEST
         // perform random sleep to test connection acquire
@@ -181,7 +235,10 @@ void Daq::insertData(std::vector<Data> const& pts) noexcept
         std::this_thread::sleep_for(std::chrono::milliseconds(distrib(gen)));
 #endif
 
+        auto t_acquire = std::chrono::steady_clock::now();
         auto conn = acquire_pool_connection_helper(stat);
+        acquire_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_acquire).count();
+        auto& rollup = run_->kpiRollup();
 
         {
             auto lg = log(debug);
@@ -195,18 +252,22 @@ void Daq::insertData(std::vector<Data> const& pts) noexcept
         }
 
         dbm::prepared_stmt stmt(insertStatement().data(),
+                                dbm::local<unsigned>(),
                                 dbm::local<time_t>(),
                                 dbm::local<double>());
+        stmt.param(0)->set(run_->id());
         unsigned long count = 0;
         unsigned long count_failed = 0;
 
         for (auto const &it: pts) {
-            stmt.param(0)->set(std::chrono::system_clock::to_time_t(it.tp));
-            stmt.param(1)->set(it.val);
-            stmt.param(1)->set_null(it.is_null);
+            stmt.param(1)->set(std::chrono::system_clock::to_time_t(it.tp));
+            stmt.param(2)->set(it.val);
+            stmt.param(2)->set_null(it.is_null);
             try {
                 query_helper(stmt, *conn, stat);
                 count++;
+                if (!it.is_null)
+                    rollup.insert(type(), it.tp, it.val);
             } catch (std::exception &e) {
                 count_failed++;
                 stat.processing_exception_count++;
@@ -215,6 +276,9 @@ void Daq::insertData(std::vector<Data> const& pts) noexcept
         }
 
         stat.records_write_count += count;
+
+        if (count > 0)
+            run_->kpiCache().touch(pts.front().tp, pts.back().tp);
         stat.records_write_failed_count += count_failed;
 
         {
@@ -4,9 +4,12 @@
 #include "Object.h"
 #include "TimeReference.h"
 #include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 
+class SimulationRun;
+
 enum class DaqType {
     energy,
     production
@@ -37,27 +40,35 @@ public:
 
     explicit Daq(std::string name);
 
+    // Daq of a simulation run - shares data with the source daq
+    Daq(Daq const& source, SimulationRun& run);
+
     virtual DaqType type() const = 0; // { return type_; }
 
-    void pingSlot(TimePoint tp);
+    // Inserts all points up to tp, returns number of points
+    size_t pingSlot(TimePoint tp);
 
     void resetIterator(TimePoint tp);
 
-    bool isIteratorValid() const { return data_.size() && iterator_ != data_.end(); }
+    bool isIteratorValid() const { return data_->size() && iterator_ != data_->end(); }
 
     TimePoint iteratorTimePoint() const;
 
-    auto const& data() const { return data_; }
+    auto const& data() const { return *data_; }
 
 protected:
     void getData();
 
     void insertData(std::vector<Data> const& pts) noexcept;
 
+    // Sends points to webclients subscribed to the channel series
+    void publishSeries(std::vector<Data> const& pts) const;
+
     virtual std::string_view insertStatement() const = 0;
 
-    std::vector<Data> data_;
+    std::shared_ptr<std::vector<Data> const> data_;
     std::vector<Data>::const_iterator iterator_;
+    SimulationRun* run_ {nullptr};
 };
 
 
@@ -70,9 +81,13 @@ public:
         getData();
     }
 
+    DaqEnergy(DaqEnergy const& source, SimulationRun& run)
+        : Daq(source, run)
+    {}
+
     DaqType type() const override { return DaqType::energy; }
 
-    std::string_view insertStatement() const override { return "SELECT upsert_energy(?, ?)"; }
+    std::string_view insertStatement() const override { return "SELECT upsert_energy(?, ?, ?)"; }
 };
 
 
@@ -85,9 +100,13 @@ public:
         getData();
     }
 
+    DaqProduction(DaqProduction const& source, SimulationRun& run)
+        : Daq(source, run)
+    {}
+
     DaqType type() const override { return DaqType::production; }
 
-    std::string_view insertStatement() const override { return "SELECT upsert_production(?, ?)"; }
+    std::string_view insertStatement() const override { return "SELECT upsert_production(?, ?, ?)"; }
 };
 
 
@@ -0,0 +1,107 @@
+#include "EnergyDelta.h"
+#include "common.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ENERGY_DELTA_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using KernelFunc = double (*)(double const*, size_t);
+
+#ifdef ENERGY_DELTA_AVX2
+__attribute__((target("avx2")))
+double energyDeltaSumAvx2(double const* val, size_t n)
+{
+    if (n < 2)
+        return 0;
+
+    size_t const n_intervals = n - 1;
+    size_t i = 0;
+    __m256d acc = _mm256_setzero_pd();
+
+    for (; i + 4 <= n_intervals; i += 4) {
+        __m256d v1 = _mm256_loadu_pd(val + i);
+        __m256d v2 = _mm256_loadu_pd(val + i + 1);
+        __m256d delta = _mm256_sub_pd(v2, v1);
+        __m256d reset = _mm256_cmp_pd(v2, v1, _CMP_LT_OQ);
+        acc = _mm256_add_pd(acc, _mm256_blendv_pd(delta, v2, reset));
+    }
+
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, acc);
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    for (; i < n_intervals; ++i)
+        sum += (val[i + 1] < val[i]) ? val[i + 1] : val[i + 1] - val[i];
+
+    return sum;
+}
+#endif
+
+KernelFunc selectKernel()
+{
+#ifdef ENERGY_DELTA_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        return energyDeltaSumAvx2;
+#endif
+    return energyDeltaSumScalar;
+}
+
+KernelFunc const kernel = selectKernel();
+
+} // namespace
+
+double energyDeltaSum(double const* val, size_t n)
+{
+    return kernel(val, n);
+}
+
+double energyDeltaSumScalar(double const* val, size_t n)
+{
+    double sum = 0;
+    for (size_t i = 1; i < n; ++i)
+        sum += (val[i] < val[i - 1]) ? val[i] : val[i] - val[i - 1];
+    return sum;
+}
+
+std::string_view energyDeltaKernelName()
+{
+#ifdef ENERGY_DELTA_AVX2
+    if (kernel == energyDeltaSumAvx2)
+        return "avx2";
+#endif
+    return "scalar";
+}
+
+double energyFirstIntervalCorrection(time_t from, time_t t1, time_t t2, double v1, double v2)
+{
+    // no correction on counter reset or when interval starts inside the window
+    if (v2 < v1 || t1 >= from)
+        return 0;
+    return v1 - lin_interpolate(from, t1, t2, v1, v2);
+}
+
+double energyLastIntervalCorrection(time_t to, time_t t1, time_t t2, double v1, double v2)
+{
+    // no correction on counter reset or when interval ends inside the window
+    if (v2 < v1 || t2 <= to)
+        return 0;
+    return lin_interpolate(to, t1, t2, v1, v2) - v2;
+}
+
+double energyIntegrate(time_t const* t, double const* val, size_t n, time_t from, time_t to)
+{
+    if (n < 2)
+        return 0;
+
+    double E = energyDeltaSum(val, n);
+    E += energyFirstIntervalCorrection(from, t[0], t[1], val[0], val[1]);
+
+    // single interval is handled as the first one only
+    if (n > 2)
+        E += energyLastIntervalCorrection(to, t[n - 2], t[n - 1], val[n - 2], val[n - 1]);
+
+    return E;
+}
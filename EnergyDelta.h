@@ -0,0 +1,29 @@
+#ifndef ZELEZARNA_ENERGYDELTA_H
+#define ZELEZARNA_ENERGYDELTA_H
+
+#include <cstddef>
+#include <ctime>
+#include <string_view>
+
+// Sum of energy counter increments over consecutive samples val[0..n).
+// A decreasing value is considered as counter reset (increment equals to the new value).
+// Uses AVX2 implementation when supported by the cpu (selected at runtime), scalar otherwise.
+double energyDeltaSum(double const* val, size_t n);
+
+// Reference scalar implementation
+double energyDeltaSumScalar(double const* val, size_t n);
+
+// Name of the implementation selected by energyDeltaSum (e.g. "avx2" or "scalar")
+std::string_view energyDeltaKernelName();
+
+// Boundary interpolation corrections to be added to energyDeltaSum result.
+// First interval (t1, v1) - (t2, v2) is interpolated to 'from' when it starts before the window,
+// last interval is interpolated to 'to' when it ends after the window.
+double energyFirstIntervalCorrection(time_t from, time_t t1, time_t t2, double v1, double v2);
+
+double energyLastIntervalCorrection(time_t to, time_t t1, time_t t2, double v1, double v2);
+
+// Energy consumed in the window [from, to] for in-memory series (t and val must be of size n)
+double energyIntegrate(time_t const* t, double const* val, size_t n, time_t from, time_t to);
+
+#endif //ZELEZARNA_ENERGYDELTA_H
@@ -0,0 +1,115 @@
+#include "KpiCache.h"
+
+namespace {
+
+constexpr time_t bucketSeconds = 3600;
+
+long long bucketIndex(time_t t)
+{
+    return t / bucketSeconds - (t % bucketSeconds < 0);
+}
+
+} // namespace
+
+double KpiCache::get(TimePoint from, TimePoint to, std::function<double()> const& calc)
+{
+    auto key = std::make_pair(ClockType::to_time_t(from), ClockType::to_time_t(to));
+    auto [first, last] = windowBuckets(from, to);
+
+    unsigned long long version;
+    unsigned long long tail_version;
+    unsigned long long epoch;
+    {
+        std::lock_guard lock(mtx_);
+        version = windowVersion(first, last);
+        tail_version = latest_data_ > (last + 1) * bucketSeconds ? 0 : global_version_;
+        epoch = epoch_;
+
+        if (auto it = entries_.find(key); it != entries_.end()) {
+            auto const& e = it->second;
+            if (e.version == version && (e.tail_version == 0 || e.tail_version == global_version_)) {
+                hits_++;
+                log(debug) << "cache hit " << TimeReference::timeStamp(from) << " - " << TimeReference::timeStamp(to);
+                return e.value;
+            }
+        }
+    }
+
+    misses_++;
+
+    // Versions are taken before calculation, a concurrent insert makes the entry stale
+    double value = calc();
+
+    std::lock_guard lock(mtx_);
+    if (epoch != epoch_)
+        return value; // cleared during calculation
+
+    entries_[key] = {value, version, tail_version};
+    while (entries_.size() > max_entries)
+        entries_.erase(entries_.begin());
+    prune();
+    return value;
+}
+
+void KpiCache::touch(TimePoint from, TimePoint to)
+{
+    Index first = bucketIndex(ClockType::to_time_t(from));
+    Index last = bucketIndex(ClockType::to_time_t(to));
+
+    std::lock_guard lock(mtx_);
+    auto stamp = ++global_version_;
+    for (Index i = std::max(first, pruned_below_); i <= last; ++i)
+        bucket_versions_[i] = stamp;
+    if (first < pruned_below_)
+        pruned_version_ = stamp;
+    latest_data_ = std::max(latest_data_, ClockType::to_time_t(to));
+    prune();
+}
+
+void KpiCache::clear()
+{
+    std::lock_guard lock(mtx_);
+    entries_.clear();
+    bucket_versions_.clear();
+    pruned_below_ = std::numeric_limits<Index>::min();
+    pruned_version_ = 0;
+    global_version_++;
+    epoch_++;
+    latest_data_ = 0;
+}
+
+KpiCache::Statistics KpiCache::statistics() const
+{
+    std::lock_guard lock(mtx_);
+    return {hits_, misses_, entries_.size(), bucket_versions_.size()};
+}
+
+unsigned long long KpiCache::windowVersion(Index first, Index last) const
+{
+    unsigned long long version = first < pruned_below_ ? pruned_version_ : 0;
+    for (auto it = bucket_versions_.lower_bound(first); it != bucket_versions_.end() && it->first <= last; ++it)
+        version = std::max(version, it->second);
+    return version;
+}
+
+void KpiCache::prune()
+{
+    if (entries_.empty())
+        return;
+
+    // first bucket of the oldest cached window (entries are ordered by window start)
+    Index threshold = bucketIndex(entries_.begin()->first.first) - 1;
+    if (threshold <= pruned_below_)
+        return;
+
+    auto end = bucket_versions_.lower_bound(threshold);
+    for (auto it = bucket_versions_.begin(); it != end; ++it)
+        pruned_version_ = std::max(pruned_version_, it->second);
+    bucket_versions_.erase(bucket_versions_.begin(), end);
+    pruned_below_ = threshold;
+}
+
+std::pair<KpiCache::Index, KpiCache::Index> KpiCache::windowBuckets(TimePoint from, TimePoint to)
+{
+    return {bucketIndex(ClockType::to_time_t(from)) - 1, bucketIndex(ClockType::to_time_t(to)) + 1};
+}
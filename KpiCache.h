@@ -0,0 +1,74 @@
+#ifndef ZELEZARNA_KPICACHE_H
+#define ZELEZARNA_KPICACHE_H
+
+#include "Object.h"
+#include "TimeReference.h"
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+
+// Cache of kpi values calculated from the database.
+// Every data insert stamps the hour buckets it touches with a new (increasing) version.
+// A cached value stays valid while no bucket in its window (+/- one hour for neighbouring
+// points) got a newer stamp. Values calculated before any data after the window end was
+// available are also invalidated by any newer insert (interpolation to window end).
+// Bucket stamps older than the oldest cached window are dropped; windows reaching below
+// them see the highest dropped stamp instead, which can only cause a miss.
+class KpiCache : public Object
+{
+public:
+    static constexpr size_t max_entries = 4096;
+
+    KpiCache()
+        : Object("KpiCache")
+    {}
+
+    // Returns cached value for window (from, to] or calls calc and caches its result
+    double get(TimePoint from, TimePoint to, std::function<double()> const& calc);
+
+    // Data in [from, to] changed
+    void touch(TimePoint from, TimePoint to);
+
+    void clear();
+
+    struct Statistics
+    {
+        unsigned long hits;
+        unsigned long misses;
+        size_t entries;
+        size_t buckets;
+    };
+
+    Statistics statistics() const;
+
+private:
+    using Index = long long;
+
+    struct Entry
+    {
+        double value;
+        unsigned long long version;         // newest bucket stamp in window
+        unsigned long long tail_version;    // global version if data after window was missing, 0 otherwise
+    };
+
+    unsigned long long windowVersion(Index first, Index last) const;
+
+    void prune();
+
+    static std::pair<Index, Index> windowBuckets(TimePoint from, TimePoint to);
+
+    std::map<std::pair<time_t, time_t>, Entry> entries_;
+    std::map<Index, unsigned long long> bucket_versions_;
+    Index pruned_below_ {std::numeric_limits<Index>::min()};
+    unsigned long long pruned_version_ {0};
+    unsigned long long global_version_ {1};
+    unsigned long long epoch_ {0};
+    time_t latest_data_ {0};
+    std::atomic<unsigned long> hits_ {0};
+    std::atomic<unsigned long> misses_ {0};
+    std::mutex mutable mtx_;
+};
+
+#endif //ZELEZARNA_KPICACHE_H
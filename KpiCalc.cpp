@@ -1,125 +1,265 @@
 #include "KpiCalc.h"
+#include "AnalyticsSession.h"
 #include "Application.h"
+#include "Daq.h"
+#include "EnergyDelta.h"
+#include "KpiCache.h"
 #include "webserver/WebsocketDataBus.h"
 #include "nlohmann/json.hpp"
 
+#include <algorithm>
+#include <numeric>
+
 using namespace std::chrono_literals;
 
 namespace {
 
 constexpr double invalidKPI = -1;
 
-template<typename Tx, typename Ty>
-Ty lin_interpolate(Tx x, Tx x1, Tx x2, Ty y1, Ty y2)
+// Column layout of get_energy / get_production result sets (time, unixtime, value)
+struct SeriesPoint
 {
-    return (y2 - y1) / (x2 - x1) * (x - x1) + y1;
-}
+    static constexpr size_t col_unixtime = 1;
+    static constexpr size_t col_value = 2;
+
+    SeriesPoint() = default;
+
+    explicit SeriesPoint(dbm::sql_row const& row)
+        : t(row.at(col_unixtime).get<time_t>())
+        , val(row.at(col_value).get_optional<double>(0))
+    {}
+
+    time_t t {0};
+    double val {0};
+};
+
+// Integrates energy counter values row by row as they are read from the result set.
+// Values are collected in a fixed size chunk and summed with energyDeltaSum kernel,
+// the last value of a chunk is carried over as the first value of the next one.
+// The first two and the last two points are kept for the boundary interpolation.
+class EnergyIntegrator
+{
+public:
+    static constexpr size_t chunk_size = 1024;
+
+    EnergyIntegrator(time_t from, time_t to)
+        : tfrom_(from)
+        , tto_(to)
+    {
+        chunk_.reserve(chunk_size);
+    }
+
+    void push(SeriesPoint const& p)
+    {
+        if (count_ == 0)
+            first_ = p;
+        else if (count_ == 1)
+            second_ = p;
+
+        if (chunk_.size() == chunk_size) {
+            Esum_ += energyDeltaSum(chunk_.data(), chunk_.size());
+            chunk_.erase(chunk_.begin(), chunk_.end() - 1);
+        }
+        chunk_.push_back(p.val);
+
+        p1_ = p2_;
+        p2_ = p;
+        ++count_;
+    }
+
+    double finish() const
+    {
+        if (count_ < 2)
+            return 0;
+
+        double E = Esum_ + energyDeltaSum(chunk_.data(), chunk_.size());
+        E += energyFirstIntervalCorrection(tfrom_, first_.t, second_.t, first_.val, second_.val);
+
+        // single interval is handled as the first one only
+        if (count_ > 2)
+            E += energyLastIntervalCorrection(tto_, p1_.t, p2_.t, p1_.val, p2_.val);
+
+        return E;
+    }
+
+    size_t count() const { return count_; }
+
+    time_t firstTime() const { return first_.t; }
+
+    time_t lastTime() const { return p2_.t; }
+
+private:
+    time_t tfrom_;
+    time_t tto_;
+    size_t count_ {0};
+    double Esum_ {0};
+    std::vector<double> chunk_;
+    SeriesPoint first_ {};
+    SeriesPoint second_ {};
+    SeriesPoint p1_ {};
+    SeriesPoint p2_ {};
+};
 
 } // namespace
 
-double KpiCalc::calculateDaily(TimePoint tp, dbm::mysql_session& db)
+KpiSeries KpiSeries::fromDaq(Daq const& daq)
+{
+    KpiSeries series;
+    series.t.reserve(daq.data().size());
+    series.val.reserve(daq.data().size());
+
+    for (auto const& it : daq.data()) {
+        if (it.is_null)
+            continue;
+        series.t.push_back(ClockType::to_time_t(it.tp));
+        series.val.push_back(it.val);
+    }
+
+    return series;
+}
+
+double KpiCalc::calculateDaily(TimePoint tp, AnalyticsSession& db)
+{
+    return cachedCalculate(db, tp - 24h, tp);
+}
+
+double KpiCalc::calculateWeekly(TimePoint tp, AnalyticsSession& db)
+{
+    log(debug) << "Calculating weekly - time point " << TimeReference::timeStamp(tp);
+
+    return cachedCalculate(db, tp - 7 * 24h, tp);
+}
+
+double KpiCalc::calculateDaily(TimePoint tp, KpiSeries const& energy, KpiSeries const& production)
 {
-    return calculate(db, tp - 24h, tp);
+    return calculate(energy, production, tp - 24h, tp);
 }
 
-double KpiCalc::calculateWeekly(TimePoint tp, dbm::mysql_session& db)
+double KpiCalc::calculateWeekly(TimePoint tp, KpiSeries const& energy, KpiSeries const& production)
 {
     log(debug) << "Calculating weekly - time point " << TimeReference::timeStamp(tp);
 
-    return calculate(db, tp - 7 * 24h, tp);
+    return calculate(energy, production, tp - 7 * 24h, tp);
 }
 
-double KpiCalc::calculate(dbm::mysql_session& db, TimePoint from, TimePoint to)
+double KpiCalc::cachedCalculate(AnalyticsSession& db, TimePoint from, TimePoint to)
+{
+    if (!cache_)
+        return calculate(db, from, to);
+
+    return cache_->get(from, to, [&] {
+        return calculate(db, from, to);
+    });
+}
+
+double KpiCalc::calculate(AnalyticsSession& db, TimePoint from, TimePoint to)
 {
     time_t tfrom = ClockType::to_time_t(from);
     time_t tto = ClockType::to_time_t(to);
 
     log(debug) << "Calculating kpi from " << TimeReference::timeStamp(from) << " to " << TimeReference::timeStamp(to) <<
         " (" << tfrom << " - " << tto << ") " <<
-        " session " << std::hex << &db;
+        " session " << db.name();
 
-    auto energy_data = dbm::sql_rows_dump(db.select(
-            (dbm::statement() << "CALL zelezarna.get_energy(" << tfrom << ", " << tto << ")").get() ));
-    auto energy_data_rows = energy_data.restore();
+    // Rows are integrated as they are iterated, no series vector is built
+    // (AnalyticsSession buffers one page of the result set)
+    EnergyIntegrator energy(tfrom, tto);
+    db.selectEnergy(tfrom, tto, [&](dbm::sql_row const& row) {
+        energy.push(SeriesPoint(row));
+    });
 
     {
         auto lg = log(debug);
-        lg << "energy data received " << energy_data_rows.size() << " entries";
-        if (!energy_data_rows.empty()) {
-            lg << " " << TimeReference::timeStamp(ClockType::from_time_t(energy_data_rows.front().at(1).get<time_t>()));
-            lg << " - " << TimeReference::timeStamp(ClockType::from_time_t(energy_data_rows.back().at(1).get<time_t>()));
+        lg << "energy data received " << energy.count() << " entries";
+        if (energy.count() > 0) {
+            lg << " " << TimeReference::timeStamp(ClockType::from_time_t(energy.firstTime()));
+            lg << " - " << TimeReference::timeStamp(ClockType::from_time_t(energy.lastTime()));
         }
     }
 
-    if (energy_data_rows.size() < 2) {
+    if (energy.count() < 2) {
         log(warning) << "cannot calculate kpi - no energy data";
         return invalidKPI;
     }
 
-    double Esum = 0;
-    auto it1 = energy_data_rows.begin();
-    auto it2 = energy_data_rows.begin() + 1;
-
-    for (; it2 != energy_data_rows.end(); ++it1, ++it2) {
-
-        time_t t1 = it1->at(1).get<time_t>();
-        time_t t2 = it2->at(1).get<time_t>();
-        double E1 = it1->at(2).get_optional<double>(0);
-        double E2 = it2->at(2).get_optional<double>(0);
-        double E;
-
-        if (it1 == energy_data_rows.begin()) {
-            // first interval
-            if (E2 < E1)
-                E = E2;
-            else if (t1 < tfrom)
-                E = E2 - lin_interpolate(tfrom, t1, t2, E1, E2);
-            else
-                E = E2 - E1;
-        }
-        else if (it2 + 1 == energy_data_rows.end()) {
-            // last interval
-            if (E2 < E1)
-                E = E2;
-            else if (t2 > tto)
-                E = lin_interpolate(tto, t1, t2, E1, E2) - E1;
-            else
-                E = E2 - E1;
-        }
-        else {
-            // all the other intervals
-            if (E2 < E1)
-                E = E2;
-            else
-                E = E2 - E1;
-        }
+    double Esum = energy.finish();
+
+    size_t production_count = 0;
+    double P = 0;
+    db.selectProduction(tfrom, tto, [&](dbm::sql_row const& row) {
+        P += SeriesPoint(row).val;
+        ++production_count;
+    });
+
+    if (production_count == 0) {
+        log(warning) << "cannot calculate kpi - no production data";
+        return invalidKPI;
+    }
+
+    return kpiValue(Esum, P);
+}
+
+double KpiCalc::calculate(KpiSeries const& energy, KpiSeries const& production, TimePoint from, TimePoint to)
+{
+    time_t tfrom = ClockType::to_time_t(from);
+    time_t tto = ClockType::to_time_t(to);
 
-        Esum += E;
+    log(debug) << "Calculating kpi (in-memory) from " << TimeReference::timeStamp(from) << " to "
+        << TimeReference::timeStamp(to) << " (" << tfrom << " - " << tto << ")";
+
+    // Same selection as get_energy procedure: last point before the window,
+    // all points inside the window and the first point after the window
+    auto e_begin = std::lower_bound(energy.t.begin(), energy.t.end(), tfrom);
+    auto e_end = std::upper_bound(e_begin, energy.t.end(), tto);
+    if (e_begin != energy.t.begin())
+        --e_begin;
+    if (e_end != energy.t.end())
+        ++e_end;
+
+    size_t e_offset = e_begin - energy.t.begin();
+    size_t e_count = e_end - e_begin;
+
+    if (e_count < 2) {
+        log(warning) << "cannot calculate kpi - no energy data";
+        return invalidKPI;
     }
 
-    auto production_data = dbm::sql_rows_dump(db.select(
-        (dbm::statement() << "CALL zelezarna.get_production(" << tfrom << ", " << tto << ")").get() ));
-    auto production_data_rows = production_data.restore();
+    double Esum = energyIntegrate(energy.t.data() + e_offset, energy.val.data() + e_offset, e_count, tfrom, tto);
 
-    if (production_data_rows.empty()) {
+    // Same selection as get_production procedure: (from, to]
+    auto p_begin = std::upper_bound(production.t.begin(), production.t.end(), tfrom);
+    auto p_end = std::upper_bound(p_begin, production.t.end(), tto);
+
+    if (p_begin == p_end) {
         log(warning) << "cannot calculate kpi - no production data";
         return invalidKPI;
     }
 
-    auto P = std::accumulate(production_data_rows.begin(),
-                             production_data_rows.end(),
-                             0.0,
-                             [](double sum, dbm::sql_row const& row) {
-        return sum + row.at(2).get_optional<double>(0);
-    });
+    double P = std::accumulate(production.val.begin() + (p_begin - production.t.begin()),
+                               production.val.begin() + (p_end - production.t.begin()),
+                               0.0);
 
-    double kpi = (P > 0) ? (Esum / P) : invalidKPI;
+    return kpiValue(Esum, P);
+}
+
+double KpiCalc::kpiValue(double Esum, double P)
+{
+    double kpi = kpiFromSums(Esum, P);
     log(debug) << "Calculated Esum " << Esum << " / P " << P << " = KPI " << kpi;
 
-    if (kpi > 30) {
+    if (P > 0 && kpi == invalidKPI) {
         log(warning) << "kpi abnormal value - consider as invalid";
-        kpi = invalidKPI;
     }
 
+    return kpi;
+}
+
+double KpiCalc::kpiFromSums(double Esum, double P)
+{
+    double kpi = (P > 0) ? (Esum / P) : invalidKPI;
+
+    if (kpi > 30)
+        kpi = invalidKPI;
+
     return kpi;
 }
\ No newline at end of file
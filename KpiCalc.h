@@ -3,10 +3,20 @@
 
 #include "Object.h"
 #include "TimeReference.h"
+#include <vector>
 
-namespace dbm {
-class mysql_session;
-}
+class AnalyticsSession;
+class Daq;
+class KpiCache;
+
+// In-memory time series (ascending time, null values excluded)
+struct KpiSeries
+{
+    std::vector<time_t> t;
+    std::vector<double> val;
+
+    static KpiSeries fromDaq(Daq const& daq);
+};
 
 class KpiCalc : public Object
 {
@@ -15,13 +25,34 @@ public:
      : Object("KpiCalc")
     {}
 
-    double calculateDaily(TimePoint tp, dbm::mysql_session& db);
+    // Database calculations are served from cache when window data has not changed
+    explicit KpiCalc(KpiCache* cache)
+     : Object("KpiCalc")
+     , cache_(cache)
+    {}
+
+    double calculateDaily(TimePoint tp, AnalyticsSession& db);
 
-    double calculateWeekly(TimePoint tp, dbm::mysql_session& db);
+    double calculateWeekly(TimePoint tp, AnalyticsSession& db);
+
+    double calculateDaily(TimePoint tp, KpiSeries const& energy, KpiSeries const& production);
+
+    double calculateWeekly(TimePoint tp, KpiSeries const& energy, KpiSeries const& production);
+
+    // Kpi from energy and production sums (invalid value -1 if production is zero or value is abnormal)
+    static double kpiFromSums(double Esum, double P);
 
 private:
 
-    double calculate(dbm::mysql_session& db, TimePoint from, TimePoint to);
+    double calculate(AnalyticsSession& db, TimePoint from, TimePoint to);
+
+    double calculate(KpiSeries const& energy, KpiSeries const& production, TimePoint from, TimePoint to);
+
+    double cachedCalculate(AnalyticsSession& db, TimePoint from, TimePoint to);
+
+    double kpiValue(double Esum, double P);
+
+    KpiCache* cache_ {nullptr};
 };
 
 #endif //ZELEZARNA_KPICALC_H
@@ -0,0 +1,131 @@
+#include "KpiRecompute.h"
+#include "KpiCalc.h"
+#include "Daq.h"
+#include "Application.h"
+#include "ThreadPool.h"
+#include "TimerWheel.h"
+#include "AnalyticsSession.h"
+
+#include <algorithm>
+#include <latch>
+#include <semaphore>
+
+using namespace std::chrono_literals;
+
+KpiRecompute::Source KpiRecompute::sourceFromString(std::string_view source)
+{
+    if (source == "memory")
+        return Source::memory;
+    else if (source == "db" || source == "database")
+        return Source::database;
+
+    throw std::runtime_error("unknown recompute source '" + std::string(source) + "'");
+}
+
+std::vector<TimePoint> KpiRecompute::calculationTimePoints(TimePoint from, TimePoint to)
+{
+    std::vector<TimePoint> tps;
+
+    for (auto tp = TimerWheel::nextTimeOfDay(from, 6); tp <= to; tp += 24h)
+        tps.push_back(tp);
+
+    return tps;
+}
+
+size_t KpiRecompute::run(unsigned run_id, TimePoint from, TimePoint to, Source source, KpiCache& cache, ThreadPool& pool,
+                         ResultCallback const& cb)
+{
+    auto tps = calculationTimePoints(from, to);
+
+    log(info) << "recompute run " << run_id << " " << tps.size() << " days " << TimeReference::timeStamp(from) << " - "
+              << TimeReference::timeStamp(to) << " source " << (source == Source::memory ? "memory" : "database");
+
+    if (tps.empty())
+        return 0;
+
+    auto t_begin = std::chrono::steady_clock::now();
+
+    KpiSeries energy_series;
+    KpiSeries production_series;
+    if (source == Source::memory) {
+        energy_series = KpiSeries::fromDaq(energy_);
+        production_series = KpiSeries::fromDaq(production_);
+    }
+
+    if (pool.workerIndex() >= 0)
+        throw std::runtime_error("recompute cannot be run from a pool worker thread");
+
+    std::vector<std::unique_ptr<AnalyticsSession>> sessions(pool.size());
+    std::atomic<size_t> n_results {0};
+    std::latch done(static_cast<std::ptrdiff_t>(tps.size()));
+
+    // at most half of the workers calculate at once, ticks of running simulations use the same pool
+    std::counting_semaphore<> slots(static_cast<std::ptrdiff_t>(std::max<size_t>(pool.size() / 2, 1)));
+    size_t submitted = 0;
+
+    for (auto const& tp : tps) {
+        slots.acquire();
+        bool accepted = pool.submit([&, tp] {
+            Finally count_down([&] {
+                slots.release();
+                done.count_down();
+            });
+
+            time_t utime = ClockType::to_time_t(tp);
+            struct tm timeinfo = {};
+            gmtime_r(&utime, &timeinfo);
+            bool sunday = timeinfo.tm_wday == 0;
+
+            try {
+                KpiCalc calc(&cache);
+
+                if (source == Source::memory) {
+                    cb({false, tp, calc.calculateDaily(tp, energy_series, production_series)});
+                    n_results++;
+                    if (sunday) {
+                        cb({true, tp, calc.calculateWeekly(tp, energy_series, production_series)});
+                        n_results++;
+                    }
+                }
+                else {
+                    // per worker session, created on first use
+                    auto& db = sessions[pool.workerIndex()];
+                    if (!db) {
+                        db = std::make_unique<AnalyticsSession>([] {
+                            return Application::instance().makeDbSession();
+                        }, run_id, "KpiRecomputeSession");
+                    }
+
+                    cb({false, tp, calc.calculateDaily(tp, *db)});
+                    n_results++;
+                    if (sunday) {
+                        cb({true, tp, calc.calculateWeekly(tp, *db)});
+                        n_results++;
+                    }
+                }
+            }
+            catch (std::exception& e) {
+                log(error) << "recompute " << TimeReference::timeStamp(tp) << " failed : " << e.what();
+            }
+        });
+
+        if (!accepted) {
+            slots.release();
+            break;
+        }
+        ++submitted;
+    }
+
+    // rejected by a stopped pool, days not submitted are not waited for
+    if (submitted < tps.size()) {
+        log(warning) << "recompute cancelled - pool stopped, " << tps.size() - submitted << " days not calculated";
+        done.count_down(static_cast<std::ptrdiff_t>(tps.size() - submitted));
+    }
+
+    done.wait();
+
+    double ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_begin).count() / 1000.0;
+    log(info) << "recompute finished " << n_results << " kpi values in " << ms << " msec (" << pool.size() << " threads)";
+
+    return n_results;
+}
@@ -0,0 +1,56 @@
+#ifndef ZELEZARNA_KPIRECOMPUTE_H
+#define ZELEZARNA_KPIRECOMPUTE_H
+
+#include "Object.h"
+#include "TimeReference.h"
+#include <functional>
+
+class Daq;
+class KpiCache;
+class ThreadPool;
+
+// Recalculates daily and weekly kpi for a whole history range. Every day is a separate
+// task on the work stealing thread pool, at most half of the workers are used at once.
+// Data is taken from the in-memory daq series or from the database (one session per worker).
+class KpiRecompute : public Object
+{
+public:
+    enum class Source
+    {
+        memory,
+        database
+    };
+
+    struct Result
+    {
+        bool weekly {false};
+        TimePoint time;         // kpi window end
+        double value {0};
+    };
+
+    using ResultCallback = std::function<void(Result const&)>;
+
+    KpiRecompute(Daq const& energy, Daq const& production)
+        : Object("KpiRecompute")
+        , energy_(energy)
+        , production_(production)
+    {}
+
+    // Runs recalculation and blocks until finished (must not be called from a pool worker thread).
+    // Database source reads data of simulation run run_id, cache - kpi cache of the run.
+    // Callback is called from worker threads as soon as each result is available.
+    // Returns number of calculated kpi values.
+    size_t run(unsigned run_id, TimePoint from, TimePoint to, Source source, KpiCache& cache, ThreadPool& pool,
+               ResultCallback const& cb);
+
+    // Daily kpi calculation time points (06:00 UTC) within [from, to]
+    static std::vector<TimePoint> calculationTimePoints(TimePoint from, TimePoint to);
+
+    static Source sourceFromString(std::string_view source);
+
+private:
+    Daq const& energy_;
+    Daq const& production_;
+};
+
+#endif //ZELEZARNA_KPIRECOMPUTE_H
@@ -0,0 +1,130 @@
+#include "KpiResults.h"
+
+#include <dbm/dbm.hpp>
+#include <dbm/drivers/mysql/mysql_session.hpp>
+
+#include <iomanip>
+#include <limits>
+
+size_t KpiResults::load(dbm::mysql_session& db)
+{
+    std::map<Key, Value> cache;
+
+    auto rows = db.select("SELECT run_id, window_type, UNIX_TIMESTAMP(window_end), value, calc_id FROM zelezarna.kpi_results");
+    for (auto const& row : rows) {
+        Key key {row.at(0).get<unsigned>(), windowFromString(row.at(1).get<std::string>()), row.at(2).get<time_t>()};
+        cache[key] = {row.at(3).get_optional<double>(-1), row.at(4).get<unsigned>()};
+    }
+
+    size_t n = cache.size();
+    {
+        std::unique_lock lock(mtx_);
+        // keep results added before load (they are newer)
+        cache_.merge(cache);
+    }
+
+    log(info) << "loaded " << n << " kpi results";
+    return n;
+}
+
+void KpiResults::add(Result const& res)
+{
+    std::unique_lock lock(mtx_);
+    cache_[{res.run_id, res.window, ClockType::to_time_t(res.end)}] = {res.value, res.calc_id};
+    pending_.push_back(res);
+}
+
+void KpiResults::flush(dbm::mysql_session& db)
+{
+    // Only one batch write at a time so batches are stored in order
+    std::lock_guard flush_lock(flush_mtx_);
+
+    while (true) {
+        std::vector<Result> batch;
+        {
+            std::unique_lock lock(mtx_);
+            if (pending_.empty())
+                return;
+            size_t n = std::min(pending_.size(), max_batch_size);
+            batch.assign(pending_.begin(), pending_.begin() + n);
+            pending_.erase(pending_.begin(), pending_.begin() + n);
+        }
+
+        std::ostringstream stmt;
+        stmt << std::setprecision(std::numeric_limits<double>::max_digits10);
+        stmt << "INSERT INTO zelezarna.kpi_results (run_id, window_type, window_end, value, calc_id) VALUES ";
+        for (size_t i = 0; i < batch.size(); ++i) {
+            auto const& it = batch[i];
+            stmt << (i ? ", " : "") << "(" << it.run_id << ", '" << windowToString(it.window) << "', FROM_UNIXTIME("
+                 << ClockType::to_time_t(it.end) << "), " << it.value << ", " << it.calc_id << ")";
+        }
+        stmt << " ON DUPLICATE KEY UPDATE value=VALUES(value), calc_id=VALUES(calc_id)";
+
+        try {
+            db.query(stmt.str());
+            log(debug) << "stored " << batch.size() << " kpi results";
+        }
+        catch (std::exception& e) {
+            log(error) << "store kpi results failed : " << e.what();
+            std::unique_lock lock(mtx_);
+            pending_.insert(pending_.begin(), batch.begin(), batch.end());
+            return;
+        }
+    }
+}
+
+size_t KpiResults::pendingCount() const
+{
+    std::shared_lock lock(mtx_);
+    return pending_.size();
+}
+
+std::vector<KpiResults::Result> KpiResults::history(unsigned run_id, Window window, TimePoint from, TimePoint to) const
+{
+    std::vector<Result> results;
+    std::shared_lock lock(mtx_);
+
+    auto it = cache_.lower_bound({run_id, window, ClockType::to_time_t(from)});
+    auto end = cache_.upper_bound({run_id, window, ClockType::to_time_t(to)});
+
+    for (; it != end; ++it) {
+        results.push_back({window, ClockType::from_time_t(std::get<2>(it->first)), it->second.value,
+                           it->second.calc_id, run_id});
+    }
+
+    return results;
+}
+
+unsigned KpiResults::maxCalculationId() const
+{
+    std::shared_lock lock(mtx_);
+    unsigned id = 0;
+    for (auto const& it : cache_)
+        id = std::max(id, it.second.calc_id);
+    return id;
+}
+
+unsigned KpiResults::maxRunId() const
+{
+    std::shared_lock lock(mtx_);
+    return cache_.empty() ? 0 : std::get<0>(cache_.rbegin()->first);
+}
+
+std::string_view KpiResults::windowToString(Window window)
+{
+    switch (window) {
+        case Window::daily: return "daily";
+        case Window::weekly: return "weekly";
+        default: return "unknown";
+    }
+}
+
+KpiResults::Window KpiResults::windowFromString(std::string_view window)
+{
+    if (window == "daily")
+        return Window::daily;
+    else if (window == "weekly")
+        return Window::weekly;
+
+    throw std::runtime_error("unknown kpi window '" + std::string(window) + "'");
+}
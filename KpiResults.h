@@ -0,0 +1,85 @@
+#ifndef ZELEZARNA_KPIRESULTS_H
+#define ZELEZARNA_KPIRESULTS_H
+
+#include "Object.h"
+#include "TimeReference.h"
+#include <chrono>
+#include <map>
+#include <shared_mutex>
+#include <tuple>
+#include <vector>
+
+namespace dbm {
+class mysql_session;
+}
+
+// Calculated kpi values persisted in kpi_results table, results of simulation runs are kept apart by run id.
+// All results are kept in memory cache (preloaded on startup) so history queries
+// don't need database access. New results are written to the database in batches.
+class KpiResults : public Object
+{
+public:
+    enum class Window
+    {
+        daily,
+        weekly
+    };
+
+    struct Result
+    {
+        Window window {Window::daily};
+        TimePoint end;          // kpi window end
+        double value {0};
+        unsigned calc_id {0};
+        unsigned run_id {0};
+    };
+
+    KpiResults()
+        : Object("KpiResults")
+    {}
+
+    // Preload all stored results into cache. Returns number of loaded results.
+    size_t load(dbm::mysql_session& db);
+
+    // Add result to cache and to the pending write batch
+    void add(Result const& res);
+
+    // Write pending batch (upsert). Pending results are kept on failure.
+    void flush(dbm::mysql_session& db);
+
+    size_t pendingCount() const;
+
+    // Cached results of the run with window end within [from, to]
+    std::vector<Result> history(unsigned run_id, Window window, TimePoint from, TimePoint to) const;
+
+    // Highest calc_id found in cache
+    unsigned maxCalculationId() const;
+
+    // Highest run id found in cache
+    unsigned maxRunId() const;
+
+    static std::string_view windowToString(Window window);
+
+    static Window windowFromString(std::string_view window);
+
+    static constexpr size_t max_batch_size = 256;
+
+    // Max time results wait for a batch to fill before they are flushed
+    static constexpr std::chrono::seconds flush_interval {2};
+
+private:
+    using Key = std::tuple<unsigned, Window, time_t>; // run id, window, window end
+
+    struct Value
+    {
+        double value;
+        unsigned calc_id;
+    };
+
+    std::map<Key, Value> cache_;
+    std::vector<Result> pending_;
+    std::shared_mutex mutable mtx_;
+    std::mutex flush_mtx_;
+};
+
+#endif //ZELEZARNA_KPIRESULTS_H
@@ -0,0 +1,212 @@
+#include "KpiRollup.h"
+#include "KpiCalc.h"
+#include "Daq.h"
+
+namespace {
+
+constexpr time_t hourSeconds = 3600;
+constexpr time_t daySeconds = 24 * hourSeconds;
+constexpr time_t dayOffset = 6 * hourSeconds;   // kpi day starts at 06:00 UTC
+
+long long floorDiv(long long a, long long b)
+{
+    return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+// Month index (year * 12 + month) of the day starting at unix time t
+long long monthIndex(time_t t)
+{
+    struct tm timeinfo = {};
+    gmtime_r(&t, &timeinfo);
+    return (timeinfo.tm_year + 1900LL) * 12 + timeinfo.tm_mon;
+}
+
+// Unix time of the first kpi day start (06:00 UTC) in the month
+time_t monthBegin(long long month)
+{
+    struct tm timeinfo = {};
+    timeinfo.tm_year = static_cast<int>(month / 12 - 1900);
+    timeinfo.tm_mon = static_cast<int>(month % 12);
+    timeinfo.tm_mday = 1;
+    return timegm(&timeinfo) + dayOffset;
+}
+
+} // namespace
+
+void KpiRollup::clear()
+{
+    std::unique_lock lock(mtx_);
+    hours_.clear();
+    days_.clear();
+    months_.clear();
+    last_energy_.reset();
+}
+
+void KpiRollup::insert(DaqType type, TimePoint tp, double val)
+{
+    time_t t = ClockType::to_time_t(tp);
+    std::unique_lock lock(mtx_);
+
+    if (type == DaqType::production) {
+        addToHour(hourIndex(t), {0, val});
+        return;
+    }
+
+    if (last_energy_) {
+        auto [t1, E1] = *last_energy_;
+        if (t <= t1) {
+            log(trace) << "energy point " << TimeReference::timeStamp(tp) << " not newer than last point - skipped";
+            return;
+        }
+        addEnergy(t1, t, (val < E1) ? val : val - E1);
+    }
+
+    last_energy_ = {t, val};
+}
+
+std::vector<KpiRollup::Entry> KpiRollup::query(Granularity g, TimePoint from, TimePoint to) const
+{
+    time_t tfrom = ClockType::to_time_t(from);
+    time_t tto = ClockType::to_time_t(to);
+    std::vector<Entry> entries;
+
+    auto add = [&](time_t end, Bucket const& b) {
+        entries.push_back({ClockType::from_time_t(end), b, KpiCalc::kpiFromSums(b.energy, b.production)});
+    };
+
+    std::shared_lock lock(mtx_);
+
+    // Fixed length periods with end times offset + k * length
+    auto forEachPeriod = [&](time_t length, time_t offset, auto&& f) {
+        for (Index k = floorDiv(tfrom - offset, length) + 1; offset + k * length <= tto; ++k)
+            f(offset + k * length);
+    };
+
+    switch (g) {
+        case Granularity::hour:
+            forEachPeriod(hourSeconds, 0, [&](time_t end) {
+                add(end, hourSum(hourIndex(end)));
+            });
+            break;
+
+        case Granularity::shift:
+            forEachPeriod(8 * hourSeconds, dayOffset, [&](time_t end) {
+                Bucket b;
+                for (Index h = hourIndex(end) - 7; h <= hourIndex(end); ++h)
+                    b += hourSum(h);
+                add(end, b);
+            });
+            break;
+
+        case Granularity::day:
+            forEachPeriod(daySeconds, dayOffset, [&](time_t end) {
+                add(end, daySum(dayOfHour(hourIndex(end))));
+            });
+            break;
+
+        case Granularity::week:
+            forEachPeriod(daySeconds, dayOffset, [&](time_t end) {
+                // every sunday (1970-01-01 was thursday)
+                if (floorDiv(end, daySeconds) % 7 != 3)
+                    return;
+                Bucket b;
+                Index d = dayOfHour(hourIndex(end));
+                for (Index i = d - 6; i <= d; ++i)
+                    b += daySum(i);
+                add(end, b);
+            });
+            break;
+
+        case Granularity::month:
+            for (Index m = monthIndex(tfrom - dayOffset); monthBegin(m + 1) <= tto; ++m) {
+                if (monthBegin(m + 1) > tfrom)
+                    add(monthBegin(m + 1), monthSum(m));
+            }
+            break;
+    }
+
+    return entries;
+}
+
+KpiRollup::Granularity KpiRollup::granularityFromString(std::string_view g)
+{
+    if (g == "hour")
+        return Granularity::hour;
+    else if (g == "shift")
+        return Granularity::shift;
+    else if (g == "day")
+        return Granularity::day;
+    else if (g == "week")
+        return Granularity::week;
+    else if (g == "month")
+        return Granularity::month;
+
+    throw std::runtime_error("unknown granularity '" + std::string(g) + "'");
+}
+
+std::string_view KpiRollup::granularityToString(Granularity g)
+{
+    switch (g) {
+        case Granularity::hour: return "hour";
+        case Granularity::shift: return "shift";
+        case Granularity::day: return "day";
+        case Granularity::week: return "week";
+        case Granularity::month: return "month";
+        default: return "unknown";
+    }
+}
+
+void KpiRollup::addEnergy(time_t t1, time_t t2, double E)
+{
+    // Split interval energy over hour buckets proportionally to time (linear interpolation)
+    double rate = E / static_cast<double>(t2 - t1);
+
+    for (time_t t = t1; t < t2; ) {
+        time_t hour_end = (floorDiv(t, hourSeconds) + 1) * hourSeconds;
+        time_t end = std::min(hour_end, t2);
+        addToHour(hourIndex(end), {rate * static_cast<double>(end - t), 0});
+        t = end;
+    }
+}
+
+void KpiRollup::addToHour(Index hour, Bucket const& b)
+{
+    Index day = dayOfHour(hour);
+    hours_[hour] += b;
+    days_[day] += b;
+    months_[monthOfDay(day)] += b;
+}
+
+KpiRollup::Bucket KpiRollup::hourSum(Index hour) const
+{
+    auto it = hours_.find(hour);
+    return it != hours_.end() ? it->second : Bucket {};
+}
+
+KpiRollup::Bucket KpiRollup::daySum(Index day) const
+{
+    auto it = days_.find(day);
+    return it != days_.end() ? it->second : Bucket {};
+}
+
+KpiRollup::Bucket KpiRollup::monthSum(Index month) const
+{
+    auto it = months_.find(month);
+    return it != months_.end() ? it->second : Bucket {};
+}
+
+// Hour bucket h holds data in the interval (h * 1h, (h + 1) * 1h]
+KpiRollup::Index KpiRollup::hourIndex(time_t t)
+{
+    return floorDiv(t - 1, hourSeconds);
+}
+
+KpiRollup::Index KpiRollup::dayOfHour(Index hour)
+{
+    return floorDiv(hour * hourSeconds - dayOffset, daySeconds);
+}
+
+KpiRollup::Index KpiRollup::monthOfDay(Index day)
+{
+    return monthIndex(day * daySeconds);
+}
@@ -0,0 +1,91 @@
+#ifndef ZELEZARNA_KPIROLLUP_H
+#define ZELEZARNA_KPIROLLUP_H
+
+#include "Object.h"
+#include "TimeReference.h"
+#include <map>
+#include <optional>
+#include <shared_mutex>
+#include <vector>
+
+enum class DaqType;
+
+// Hierarchical time bucket aggregation of energy and production data.
+// Hour buckets hold energy delta (interpolated over bucket boundaries) and production,
+// day buckets (06:00 - 06:00 UTC, same as daily kpi window) aggregate hours and
+// month buckets aggregate days. Buckets are updated incrementally as data is inserted,
+// queries read pre-aggregated buckets only.
+class KpiRollup : public Object
+{
+public:
+    enum class Granularity
+    {
+        hour,
+        shift,      // 8h shifts starting at 06:00, 14:00 and 22:00
+        day,
+        week,       // 7 days ending on Sunday 06:00
+        month
+    };
+
+    struct Bucket
+    {
+        double energy {0};
+        double production {0};
+
+        Bucket& operator+=(Bucket const& other)
+        {
+            energy += other.energy;
+            production += other.production;
+            return *this;
+        }
+    };
+
+    struct Entry
+    {
+        TimePoint time;     // period end
+        Bucket sum;
+        double kpi;
+    };
+
+    KpiRollup()
+        : Object("KpiRollup")
+    {}
+
+    void clear();
+
+    void insert(DaqType type, TimePoint tp, double val);
+
+    // Periods of the requested granularity ending within (from, to]
+    std::vector<Entry> query(Granularity g, TimePoint from, TimePoint to) const;
+
+    static Granularity granularityFromString(std::string_view g);
+
+    static std::string_view granularityToString(Granularity g);
+
+private:
+    using Index = long long;
+
+    void addEnergy(time_t t1, time_t t2, double E);
+
+    void addToHour(Index hour, Bucket const& b);
+
+    Bucket hourSum(Index hour) const;
+
+    Bucket daySum(Index day) const;
+
+    Bucket monthSum(Index month) const;
+
+    static Index hourIndex(time_t t);
+
+    static Index dayOfHour(Index hour);
+
+    static Index monthOfDay(Index day);
+
+    std::map<Index, Bucket> hours_;
+    std::map<Index, Bucket> days_;
+    std::map<Index, Bucket> months_;
+    std::optional<std::pair<time_t, double>> last_energy_;
+    std::shared_mutex mutable mtx_;
+};
+
+#endif //ZELEZARNA_KPIROLLUP_H
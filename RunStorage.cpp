@@ -0,0 +1,86 @@
+#include "RunStorage.h"
+
+#include <dbm/dbm.hpp>
+#include <dbm/drivers/mysql/mysql_session.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+void RunStorage::reset(dbm::mysql_session& db, unsigned run_id)
+{
+    std::lock_guard lock(mtx_);
+    auto t_begin = std::chrono::steady_clock::now();
+    auto partition = partitionName(run_id);
+
+    for (std::string table : tables) {
+        auto parts = partitions(db, table);
+
+        if (std::find(parts.begin(), parts.end(), partition) != parts.end()) {
+            db.query("ALTER TABLE " + table + " TRUNCATE PARTITION " + partition);
+        }
+        else {
+            db.query("ALTER TABLE " + table + " ADD PARTITION (PARTITION " + partition +
+                     " VALUES IN (" + std::to_string(run_id) + "))");
+        }
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_begin).count();
+    log(info) << "run " << run_id << " data reset in " << ms << " msec";
+}
+
+void RunStorage::drop(dbm::mysql_session& db, unsigned run_id)
+{
+    if (run_id == 0) {
+        reset(db, run_id);
+        return;
+    }
+
+    std::lock_guard lock(mtx_);
+    auto partition = partitionName(run_id);
+
+    for (std::string table : tables) {
+        auto parts = partitions(db, table);
+
+        if (std::find(parts.begin(), parts.end(), partition) != parts.end()) {
+            db.query("ALTER TABLE " + table + " DROP PARTITION " + partition);
+        }
+    }
+
+    log(info) << "run " << run_id << " data removed";
+}
+
+void RunStorage::resetAll(dbm::mysql_session& db)
+{
+    std::lock_guard lock(mtx_);
+    auto default_partition = partitionName(0);
+
+    for (std::string table : tables) {
+        // partitions left by runs of the previous process
+        for (auto const& partition : partitions(db, table)) {
+            if (partition != default_partition)
+                db.query("ALTER TABLE " + table + " DROP PARTITION " + partition);
+        }
+
+        db.query("TRUNCATE TABLE " + table);
+    }
+
+    log(info) << "data of all runs removed";
+}
+
+std::vector<std::string> RunStorage::partitions(dbm::mysql_session& db, std::string const& table)
+{
+    std::vector<std::string> result;
+
+    auto rows = db.select("SELECT PARTITION_NAME FROM information_schema.PARTITIONS "
+                          "WHERE TABLE_SCHEMA='zelezarna' AND TABLE_NAME='" + table + "' "
+                          "AND PARTITION_NAME IS NOT NULL");
+    for (auto const& row : rows)
+        result.push_back(row.at(0).get<std::string>());
+
+    // schema before partitioning has no run_id column, rows of runs cannot be told apart
+    if (result.empty())
+        throw std::runtime_error(table + " is not partitioned by run_id - recreate the schema with database/create_schema.sql");
+
+    return result;
+}
@@ -0,0 +1,46 @@
+#ifndef ZELEZARNA_RUNSTORAGE_H
+#define ZELEZARNA_RUNSTORAGE_H
+
+#include "Object.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace dbm {
+class mysql_session;
+}
+
+// Data tables storage of simulation runs.
+// energy_data and production_data are partitioned by run_id (one LIST partition per run),
+// so run data is reset with TRUNCATE PARTITION and removed with DROP PARTITION - both
+// are metadata operations taking constant time regardless of the number of rows.
+// Tables without partitioning (schema before partitioning) are rejected with an error.
+// Note: ALTER TABLE ... TRUNCATE/ADD/DROP PARTITION takes a table-wide metadata lock, so
+// inserts of all other runs stall until the statement finishes (e.g. when a run is closed).
+class RunStorage : public Object
+{
+public:
+    RunStorage()
+        : Object("RunStorage")
+    {}
+
+    // Removes all rows of the run, creates run partition if it doesn't exist
+    void reset(dbm::mysql_session& db, unsigned run_id);
+
+    // Removes the run partition (default run partition is only truncated)
+    void drop(dbm::mysql_session& db, unsigned run_id);
+
+    // Removes data of all runs and partitions of all runs except the default one
+    void resetAll(dbm::mysql_session& db);
+
+    static std::string partitionName(unsigned run_id) { return "r" + std::to_string(run_id); }
+
+private:
+    static std::vector<std::string> partitions(dbm::mysql_session& db, std::string const& table);
+
+    static constexpr const char* tables[] = {"energy_data", "production_data"};
+
+    std::mutex mtx_; // partition management statements are serialized
+};
+
+#endif //ZELEZARNA_RUNSTORAGE_H
@@ -0,0 +1,451 @@
+#include "SimulationRun.h"
+#include "AnalyticsSession.h"
+#include "Application.h"
+#include "Daq.h"
+#include "KpiCalc.h"
+#include "KpiRecompute.h"
+#include "ThreadPool.h"
+#include "webserver/WebsocketDataBus.h"
+#include "nlohmann/json.hpp"
+
+#include <dbm/drivers/mysql/mysql_session.hpp>
+
+using namespace std::chrono_literals;
+
+SimulationRun::SimulationRun(unsigned id, DaqEnergy const& energy, DaqProduction const& production, ThreadPool& executor)
+    : Object("SimulationRun")
+    , id_(id)
+    , daq_energy_(std::make_unique<DaqEnergy>(energy, *this))
+    , daq_production_(std::make_unique<DaqProduction>(production, *this))
+    , analytics_session_(std::make_unique<AnalyticsSession>([] {
+        return Application::instance().makeDbSession();
+    }, id))
+    , tick_strand_(std::make_unique<Strand>(executor))
+    , kpi_strand_(std::make_unique<Strand>(executor))
+{
+    for (Daq* daq : { static_cast<Daq*>(daq_energy_.get()), static_cast<Daq*>(daq_production_.get()) })
+        channels_.push_back({daq, std::make_unique<Strand>(executor)});
+
+    auto minmax = std::minmax(daq_energy_->data().begin()->tp, daq_production_->data().begin()->tp);
+
+    tp_initial_ = minmax.second + 14 * 24h;
+    resetIterators();
+
+    timeref_.setChangedCallback([this] {
+        onSimulationChanged();
+    });
+    timeref_.registerPingCallback(this, std::bind(&SimulationRun::onTimePing, this, std::placeholders::_1));
+
+    // initial status for webclients connecting later
+    onSimulationChanged();
+
+    log(info) << "run " << id_ << " created";
+}
+
+SimulationRun::~SimulationRun()
+{
+    timeref_.setChangedCallback({});
+    timeref_.stop();
+    timeref_.waitIdle();
+    timeref_.unregisterPingCallback(this);
+
+    log(info) << "run " << id_ << " closed";
+}
+
+void SimulationRun::start(unsigned calculation_id)
+{
+    // inserts of the previous start must not land after the reset
+    if (!drain(std::chrono::steady_clock::now() + Application::instance().options.shutdown_timeout))
+        throw std::runtime_error("ticks of the previous start still in progress");
+
+    resetIterators();
+    try {
+        cleanDatabase();
+    }
+    catch (std::exception&) {
+        log(error) << "Clean database failed";
+    }
+
+    // late joiners must not get kpi and series of the previous start
+    WebsocketDataBus::instance().forgetRunResults(id_);
+
+    calculation_id_ = calculation_id;
+    speed_governor_.reset();
+    timeref_.setSpeedLimit(0);
+    timeref_.start(tp_initial_);
+}
+
+void SimulationRun::stop()
+{
+    timeref_.stop();
+}
+
+bool SimulationRun::drain(std::chrono::steady_clock::time_point deadline)
+{
+    timeref_.stop();
+
+    if (!timeref_.waitIdleUntil(deadline)) {
+        auto stat = timeref_.tickStatistics();
+        log(error) << "run " << id_ << " drain timeout, " << stat.ticks_count - stat.ticks_finished << " ticks in progress";
+        return false;
+    }
+
+    return true;
+}
+
+bool SimulationRun::acceptCommand(nlohmann::json const& cmd)
+{
+    auto& timeref = timeref_;
+    auto type = cmd["type"];
+
+    if (type == "start") {
+        start(Application::instance().nextCalculationId());
+    }
+    else if (type == "stop") {
+        // stopped run has all rows and kpi of its ticks stored
+        auto& app = Application::instance();
+        if (!drain(std::chrono::steady_clock::now() + app.options.shutdown_timeout))
+            throw std::runtime_error("ticks still in progress");
+        app.storeKpiResults();
+    }
+    else if (type == "pause") {
+        timeref.pause(true);
+    }
+    else if (type == "resume") {
+        timeref.pause(false);
+    }
+    else if (type == "speed") {
+        timeref.setSpeed(cmd.at("value").get<unsigned>());
+    }
+    else if (type == "kpi_rollup") {
+        auto to = cmd.contains("to") ? ClockType::from_time_t(cmd["to"].get<time_t>()) : timeref.simulatorCurrentTime();
+        auto from = cmd.contains("from") ? ClockType::from_time_t(cmd["from"].get<time_t>()) : tp_initial_;
+        sendKpiRollupMessage(KpiRollup::granularityFromString(cmd.at("granularity").get<std::string>()), from, to);
+    }
+    else if (type == "tick_period") {
+        timeref.setTickPeriod(std::chrono::milliseconds(cmd.at("value").get<unsigned>()));
+    }
+    else if (type == "mode") {
+        if (cmd.contains("max_rows_per_sec"))
+            timeref.setReplayRowsLimit(cmd["max_rows_per_sec"].get<double>());
+        timeref.setMode(TimeReference::modeFromString(cmd.at("value").get<std::string>()));
+    }
+    else if (type == "speed_governor") {
+        auto settings = speed_governor_.settings();
+        settings.enabled = cmd.value("enabled", settings.enabled);
+        settings.insert_latency_ms = cmd.value("insert_latency_ms", settings.insert_latency_ms);
+        settings.acquire_latency_ms = cmd.value("acquire_latency_ms", settings.acquire_latency_ms);
+        settings.queue_depth = cmd.value("queue_depth", settings.queue_depth);
+        speed_governor_.setSettings(settings);
+        if (!settings.enabled)
+            timeref.setSpeedLimit(0);
+        onSimulationChanged();
+    }
+    else if (type == "overrun_policy") {
+        timeref.setOverrunPolicy(TimeReference::overrunPolicyFromString(cmd.at("value").get<std::string>()));
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+void SimulationRun::onSimulationChanged() const
+{
+    WebsocketDataBus::instance().messageToWebclients(statusMessage());
+}
+
+nlohmann::json SimulationRun::statusMessage() const
+{
+    auto const& timeref = timeref_;
+    nlohmann::json j;
+    j["run_id"] = id_;
+    j["sim_time"] = timeref.simulatorCurrentUnixtime();
+    j["sim_status"] = timeref.status();
+    j["sim_speed"] = timeref.speed();
+    j["sim_mode"] = timeref.modeToString(timeref.mode());
+    j["tick_period_ms"] = timeref.tickPeriod().count();
+    j["sim_rate"] = timeref.simRate();
+    j["replay_max_rows_per_sec"] = timeref.replayRowsLimit();
+    j["overrun_policy"] = timeref.overrunPolicyToString(timeref.overrunPolicy());
+    j["sim_effective_speed"] = timeref.effectiveSpeed();
+    j["speed_governor"] = speed_governor_.enabled();
+    j["sustainable_speed"] = speed_governor_.sustainableSpeed();
+
+    return j;
+}
+
+nlohmann::json SimulationRun::statistics() const
+{
+    auto statistics = operation_statistics_; // make a copy
+    nlohmann::json json;
+
+    auto cache_stat = kpi_cache_.statistics();
+    json["kpi_cache"] = {
+            { "hits", cache_stat.hits },
+            { "misses", cache_stat.misses },
+            { "entries", cache_stat.entries },
+            { "buckets", cache_stat.buckets }
+    };
+
+    auto analytics_stat = analytics_session_->statistics();
+    json["analytics_session"] = {
+            { "connects", analytics_stat.connects },
+            { "reconnects", analytics_stat.reconnects },
+            { "health_checks", analytics_stat.health_checks },
+            { "queries", analytics_stat.queries },
+            { "query_failures", analytics_stat.query_failures }
+    };
+
+    auto tick_stat = timeref_.tickStatistics();
+    json["ticks"] = {
+            { "ticks_count", tick_stat.ticks_count },
+            { "ticks_finished", tick_stat.ticks_finished },
+            { "overrun_count", tick_stat.overrun_count },
+            { "deadline_miss_count", tick_stat.deadline_miss_count },
+            { "skipped_count", tick_stat.skipped_count },
+            { "merged_count", tick_stat.merged_count },
+            { "slowed_count", tick_stat.slowed_count },
+            { "last_duration_ms", tick_stat.last_duration_ms },
+            { "avg_duration_ms", tick_stat.avg_duration_ms },
+            { "max_duration_ms", tick_stat.max_duration_ms },
+            { "sim_time_held_s", tick_stat.sim_time_held_s }
+    };
+
+    auto governor_stat = speed_governor_.statistics();
+    json["speed_governor"] = {
+            { "enabled", governor_stat.enabled },
+            { "speed_limit", governor_stat.speed_limit },
+            { "sustainable_speed", governor_stat.sustainable_speed },
+            { "decrease_count", governor_stat.decrease_count },
+            { "increase_count", governor_stat.increase_count },
+            { "insert_latency_ms", governor_stat.insert_latency_ms },
+            { "acquire_latency_ms", governor_stat.acquire_latency_ms },
+            { "queue_depth", governor_stat.queue_depth }
+    };
+
+    json["daq"] = nlohmann::json::array();
+
+    for (auto const& stat : statistics) {
+        nlohmann::json node;
+        node["item_name"] = stat.first;
+        node["operations_count"] = stat.second.operations_count;
+        node["processing_exception_count"] = stat.second.processing_exception_count;
+        node["acquire_db_session_count"] = stat.second.acquire_db_session_count;
+        node["acquire_db_session_failed_count"] = stat.second.acquire_db_session_failed_count;
+        node["prepared_stmt_reuse_count"] = stat.second.prepared_stmt_reuse_count;
+        node["records_to_write_count"] = stat.second.records_to_write_count;
+        node["records_write_count"] = stat.second.records_write_count;
+        node["records_write_failed_count"] = stat.second.records_write_failed_count;
+        json["daq"].push_back(std::move(node));
+    }
+
+    return json;
+}
+
+void SimulationRun::resetStatistics()
+{
+    timeref_.resetTickStatistics();
+
+    for (auto& it : operation_statistics_) {
+        it.second.reset();
+    }
+}
+
+void SimulationRun::cleanDatabase()
+{
+    auto& app = Application::instance();
+    auto conn = app.pool().acquire();
+    app.runStorage().reset(conn.get(), id_);
+    kpi_cache_.clear();
+}
+
+void SimulationRun::messageToWebclients(nlohmann::json&& j) const
+{
+    j["run_id"] = id_;
+    WebsocketDataBus::instance().messageToWebclients(std::move(j));
+}
+
+void SimulationRun::sendKpiRollupMessage(KpiRollup::Granularity g, TimePoint from, TimePoint to) const
+{
+    nlohmann::json values = nlohmann::json::array();
+    for (auto const& it : kpi_rollup_.query(g, from, to)) {
+        values.push_back({
+            { "time", ClockType::to_time_t(it.time) },
+            { "value", it.kpi },
+            { "energy", it.sum.energy },
+            { "production", it.sum.production }
+        });
+    }
+
+    messageToWebclients(nlohmann::json {
+            {"kpi_rollup", {
+                    { "granularity", KpiRollup::granularityToString(g) },
+                    { "values", std::move(values) },
+                    { "calc_id", calculation_id_ }
+            }
+            }});
+}
+
+void SimulationRun::sendKpiHistoryMessage(TimePoint from, TimePoint to)
+{
+    from = std::max(from, tp_initial_);
+    to = std::min(to, timeref_.simulatorCurrentTime());
+
+    kpi_strand_->post([this, from, to] {
+        nlohmann::json daily = nlohmann::json::array();
+        nlohmann::json weekly = nlohmann::json::array();
+        KpiCalc calc(&kpi_cache_);
+
+        try {
+            for (auto const& tp : KpiRecompute::calculationTimePoints(from, to)) {
+                time_t utime = ClockType::to_time_t(tp);
+                struct tm timeinfo = {};
+                gmtime_r(&utime, &timeinfo);
+
+                daily.push_back({
+                    { "time", utime },
+                    { "value", calc.calculateDaily(tp, *analytics_session_) },
+                    { "calc_id", calculation_id_ }
+                });
+                if (timeinfo.tm_wday == 0) {
+                    weekly.push_back({
+                        { "time", utime },
+                        { "value", calc.calculateWeekly(tp, *analytics_session_) },
+                        { "calc_id", calculation_id_ }
+                    });
+                }
+            }
+        }
+        catch (std::exception& e) {
+            log(error) << "kpi history failed : " << e.what();
+            return;
+        }
+
+        messageToWebclients(nlohmann::json {
+                {"kpi_history", {
+                        { "daily", std::move(daily) },
+                        { "weekly", std::move(weekly) }
+                }
+                }});
+    });
+}
+
+void SimulationRun::onTimePing(TimePoint tp)
+{
+    timeref_.tickStarted();
+
+    tick_strand_->post([this, tp] {
+        processTick(tp);
+    });
+}
+
+void SimulationRun::processTick(TimePoint tp)
+{
+    auto& timeref = timeref_;
+    auto now = std::chrono::steady_clock::now();
+
+    // Short tick periods and replay mode produce ticks faster than clients can follow - limit sim time messages
+    if (now - sim_time_msg_sent_ >= 100ms) {
+        sim_time_msg_sent_ = now;
+        messageToWebclients(nlohmann::json{
+            {"sim_time", ClockType::to_time_t(tp)},
+            {"sim_rate", timeref.simRate()},
+            {"sim_effective_speed", timeref.effectiveSpeed()},
+            {"sustainable_speed", speed_governor_.sustainableSpeed()},
+            {"calc_id", calculation_id_}
+        });
+    }
+
+    // Each channel processes its ticks in order on its own strand, channels run in parallel.
+    // The last channel to finish the tick continues with kpi (kpi steps are ordered as well).
+    auto remaining = std::make_shared<std::atomic<size_t>>(channels_.size());
+    auto rows = std::make_shared<std::atomic<size_t>>(0);
+
+    for (auto& ch : channels_) {
+        ch.strand->post([this, tp, daq = ch.daq, remaining, rows] {
+            *rows += daq->pingSlot(tp);
+            if (--*remaining == 0) {
+                kpi_strand_->post([this, tp, rows] {
+                    processKpi(tp);
+                    governSpeed();
+                    timeref_.tickFinished(*rows);
+                });
+            }
+        });
+    }
+}
+
+void SimulationRun::governSpeed()
+{
+    if (!speed_governor_.enabled())
+        return;
+
+    // Ticks waiting behind the finished one
+    size_t queue_depth = tick_strand_->pendingTasks();
+    for (auto const& ch : channels_)
+        queue_depth = std::max(queue_depth, ch.strand->pendingTasks());
+
+    timeref_.setSpeedLimit(speed_governor_.tickFinished(timeref_.speed(), queue_depth));
+}
+
+void SimulationRun::processKpi(TimePoint tp)
+{
+    // all kpi events due up to the tick time, in order (a tick can span several days),
+    // results are stored in batches off the kpi strand
+    kpi_timers_.advance(tp);
+    Application::instance().scheduleKpiFlush();
+}
+
+void SimulationRun::calculateKpi(KpiResults::Window window, TimePoint due)
+{
+    auto& db = *analytics_session_; // long lived session (not from pool)
+    bool weekly = window == KpiResults::Window::weekly;
+
+    try {
+        KpiCalc calc(&kpi_cache_);
+        double kpi = weekly ? calc.calculateWeekly(due, db) : calc.calculateDaily(due, db);
+        Application::instance().kpiResults().add({window, due, kpi, calculation_id_, id_});
+
+        messageToWebclients(nlohmann::json {
+                {weekly ? "kpi_weekly" : "kpi_daily", {
+                        { "time", ClockType::to_time_t(due) },
+                        { "value", kpi },
+                        { "calc_id", calculation_id_ }
+                }
+                }});
+    }
+    catch (std::exception& e) {
+        log(error) << "kpi calculate " << KpiResults::windowToString(window) << " failed : " << e.what();
+    }
+}
+
+void SimulationRun::scheduleKpi()
+{
+    using Window = KpiResults::Window;
+
+    // daily kpi at 06:00 UTC starting on the day of the initial time, weekly kpi on sundays
+    auto daily = TimerWheel::timeOfDay(tp_initial_, 6);
+
+    kpi_timers_.reset(tp_initial_);
+    kpi_timers_.schedule(daily, [this](TimePoint due) {
+        calculateKpi(Window::daily, due);
+    }, TimerWheel::every(24h));
+    kpi_timers_.schedule(TimerWheel::nextWeekday(daily, 0, 6), [this](TimePoint due) {
+        calculateKpi(Window::weekly, due);
+    }, TimerWheel::every(7 * 24h));
+
+    log(debug) << "Next kpi calculation time " << TimeReference::timeStamp(daily);
+}
+
+void SimulationRun::resetIterators()
+{
+    resetStatistics();
+    kpi_rollup_.clear();
+
+    daq_energy_->resetIterator(tp_initial_);
+    daq_production_->resetIterator(tp_initial_);
+
+    scheduleKpi();
+}
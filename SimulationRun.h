@@ -0,0 +1,133 @@
+#ifndef ZELEZARNA_SIMULATIONRUN_H
+#define ZELEZARNA_SIMULATIONRUN_H
+
+#include "Object.h"
+#include "common.h"
+#include "TimeReference.h"
+#include "KpiRollup.h"
+#include "KpiCache.h"
+#include "KpiResults.h"
+#include "SpeedGovernor.h"
+#include "TimerWheel.h"
+#include "nlohmann/json_fwd.hpp"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+class AnalyticsSession;
+class Daq;
+class DaqEnergy;
+class DaqProduction;
+class Strand;
+class ThreadPool;
+
+// Isolated simulation run (back-test).
+// Every run has its own clock, daq iterators, kpi state and statistics, its data rows
+// are tagged with the run id. Runs share the executor, the db pool and kpi results.
+// Messages of the run are sent to webclients with run_id.
+class SimulationRun : public Object
+{
+public:
+    SimulationRun(unsigned id, DaqEnergy const& energy, DaqProduction const& production, ThreadPool& executor);
+
+    SimulationRun(SimulationRun const&) = delete;
+
+    SimulationRun& operator=(SimulationRun const&) = delete;
+
+    // Stops the clock and waits for ticks in progress
+    ~SimulationRun() override;
+
+    unsigned id() const { return id_; }
+
+    TimeReference& timeReference() { return timeref_; }
+
+    TimePoint initialTime() const { return tp_initial_; }
+
+    // Resets the run, deletes its data and starts the clock (throws if ticks of the previous
+    // start don't finish within the shutdown timeout)
+    void start(unsigned calculation_id);
+
+    void stop();
+
+    // Stops the clock and waits until ticks in progress finish their inserts and kpi,
+    // returns false if ticks are still running at the deadline
+    bool drain(std::chrono::steady_clock::time_point deadline);
+
+    // Run scoped websocket command, returns false if command type is not a run command
+    bool acceptCommand(nlohmann::json const& cmd);
+
+    nlohmann::json statusMessage() const;
+
+    void onSimulationChanged() const;
+
+    // Run statistics (operation_statistics nodes)
+    nlohmann::json statistics() const;
+
+    void resetStatistics();
+
+    // Removes run data (truncates run partition)
+    void cleanDatabase();
+
+    void messageToWebclients(nlohmann::json&& j) const;
+
+    auto& operationStatistics(std::string const& key) { return operation_statistics_[key]; }
+
+    auto& kpiRollup() { return kpi_rollup_; }
+
+    auto& kpiCache() { return kpi_cache_; }
+
+    // Sends daily and weekly kpi of the simulated range within [from, to] calculated from
+    // database data through the kpi cache (kpi_history message, calculated on the kpi strand)
+    void sendKpiHistoryMessage(TimePoint from, TimePoint to);
+
+    auto& speedGovernor() { return speed_governor_; }
+
+private:
+    void sendKpiRollupMessage(KpiRollup::Granularity g, TimePoint from, TimePoint to) const;
+
+    void onTimePing(TimePoint tp);
+
+    void processTick(TimePoint tp);
+
+    void processKpi(TimePoint tp);
+
+    void calculateKpi(KpiResults::Window window, TimePoint due);
+
+    // Registers recurring kpi events (kpi strand or stopped run only)
+    void scheduleKpi();
+
+    // Feeds the finished tick to the speed governor and applies its speed limit
+    void governSpeed();
+
+    void resetIterators();
+
+    unsigned id_;
+    TimeReference timeref_;
+    std::unique_ptr<DaqEnergy> daq_energy_;
+    std::unique_ptr<DaqProduction> daq_production_;
+    std::unique_ptr<AnalyticsSession> analytics_session_;
+
+    // Data acquisition channel with its serial queue (ticks of one channel never overlap)
+    struct Channel
+    {
+        Daq* daq;
+        std::unique_ptr<Strand> strand;
+    };
+
+    std::vector<Channel> channels_;
+    std::unique_ptr<Strand> tick_strand_;
+    std::unique_ptr<Strand> kpi_strand_;
+    std::chrono::steady_clock::time_point sim_time_msg_sent_; // tick strand only
+
+    TimePoint tp_initial_;
+    TimerWheel kpi_timers_; // kpi strand only
+
+    unsigned calculation_id_ {0};
+    std::map<std::string, OpearationStatistics> operation_statistics_;
+    KpiRollup kpi_rollup_;
+    KpiCache kpi_cache_;
+    SpeedGovernor speed_governor_;
+};
+
+#endif //ZELEZARNA_SIMULATIONRUN_H
@@ -0,0 +1,121 @@
+#include "SpeedGovernor.h"
+
+#include <algorithm>
+#include <cmath>
+
+SpeedGovernor::Settings SpeedGovernor::settings() const
+{
+    std::lock_guard lock(mtx_);
+    return settings_;
+}
+
+void SpeedGovernor::setSettings(Settings const& s)
+{
+    {
+        std::lock_guard lock(mtx_);
+        settings_ = s;
+    }
+    enable(s.enabled);
+}
+
+void SpeedGovernor::enable(bool val)
+{
+    {
+        std::lock_guard lock(mtx_);
+        settings_.enabled = val;
+    }
+
+    if (enabled_.exchange(val) != val) {
+        log(info) << "speed governor " << (val ? "enabled" : "disabled");
+        reset();
+    }
+}
+
+void SpeedGovernor::recordInsert(double insert_ms, double acquire_ms)
+{
+    if (!enabled_)
+        return;
+
+    std::lock_guard lock(mtx_);
+    tick_insert_ms_ = std::max(tick_insert_ms_, insert_ms);
+    tick_acquire_ms_ = std::max(tick_acquire_ms_, acquire_ms);
+}
+
+unsigned SpeedGovernor::tickFinished(unsigned requested_speed, size_t queue_depth)
+{
+    if (!enabled_)
+        return 0;
+
+    std::lock_guard lock(mtx_);
+
+    avg_insert_ms_ += smoothing * (tick_insert_ms_ - avg_insert_ms_);
+    avg_acquire_ms_ += smoothing * (tick_acquire_ms_ - avg_acquire_ms_);
+    tick_insert_ms_ = 0;
+    tick_acquire_ms_ = 0;
+    last_queue_depth_ = queue_depth;
+
+    unsigned limit = speed_limit_ ? std::min(speed_limit_.load(), requested_speed) : requested_speed;
+
+    bool violated = avg_insert_ms_ > settings_.insert_latency_ms ||
+                    avg_acquire_ms_ > settings_.acquire_latency_ms ||
+                    queue_depth > settings_.queue_depth;
+
+    if (cooldown_ > 0)
+        --cooldown_;
+
+    if (violated) {
+        // smoothed latencies lag behind the cut - give the pipeline a few ticks to recover
+        if (cooldown_ == 0) {
+            limit = std::max(1u, static_cast<unsigned>(limit * decrease_factor));
+            cooldown_ = cooldown_ticks;
+            decrease_count_++;
+            log(info) << "pipeline overloaded (insert " << avg_insert_ms_ << " ms, acquire " << avg_acquire_ms_
+                      << " ms, queue " << queue_depth << ") - speed limited to " << limit;
+        }
+        sustainable_speed_ = limit;
+    }
+    else {
+        bool has_headroom = avg_insert_ms_ < settings_.insert_latency_ms * headroom &&
+                            avg_acquire_ms_ < settings_.acquire_latency_ms * headroom &&
+                            queue_depth == 0;
+
+        if (has_headroom && limit < requested_speed && cooldown_ == 0) {
+            limit = std::min(requested_speed, std::max(limit + 1, static_cast<unsigned>(std::ceil(limit * increase_factor))));
+            increase_count_++;
+        }
+        sustainable_speed_ = std::max(sustainable_speed_.load(), limit);
+    }
+
+    speed_limit_ = limit < requested_speed ? limit : 0;
+    return speed_limit_;
+}
+
+void SpeedGovernor::reset()
+{
+    std::lock_guard lock(mtx_);
+    speed_limit_ = 0;
+    sustainable_speed_ = 0;
+    tick_insert_ms_ = 0;
+    tick_acquire_ms_ = 0;
+    avg_insert_ms_ = 0;
+    avg_acquire_ms_ = 0;
+    last_queue_depth_ = 0;
+    decrease_count_ = 0;
+    increase_count_ = 0;
+    cooldown_ = 0;
+}
+
+SpeedGovernor::Statistics SpeedGovernor::statistics() const
+{
+    std::lock_guard lock(mtx_);
+    return {
+        enabled_,
+        speed_limit_,
+        sustainable_speed_,
+        decrease_count_,
+        increase_count_,
+        avg_insert_ms_,
+        avg_acquire_ms_,
+        last_queue_depth_
+    };
+}
@@ -0,0 +1,86 @@
+#ifndef ZELEZARNA_SPEEDGOVERNOR_H
+#define ZELEZARNA_SPEEDGOVERNOR_H
+
+#include "Object.h"
+#include <atomic>
+#include <mutex>
+
+// Limits the effective simulation speed to what the database pipeline can sustain.
+// Daq inserts report insert and pool acquire latencies, at the end of every tick the
+// worst latencies of the tick and the queue depth are compared with the limits:
+// the speed limit is cut on violation (multiplicative decrease) and slowly raised
+// back towards the requested speed while the pipeline has headroom.
+class SpeedGovernor : public Object
+{
+public:
+    SpeedGovernor()
+        : Object("SpeedGovernor")
+    {}
+
+    struct Settings
+    {
+        bool enabled {false};
+        double insert_latency_ms {250};     // insert latency SLO (whole insert incl. acquire)
+        double acquire_latency_ms {50};     // pool acquire latency SLO
+        size_t queue_depth {2};             // max ticks waiting in the pipeline
+    };
+
+    Settings settings() const;
+
+    void setSettings(Settings const& s);
+
+    void enable(bool val);
+
+    bool enabled() const { return enabled_; }
+
+    // Called from Daq insert
+    void recordInsert(double insert_ms, double acquire_ms);
+
+    // Evaluates the finished tick, returns new speed limit (0 - no limit)
+    unsigned tickFinished(unsigned requested_speed, size_t queue_depth);
+
+    // Current speed limit (0 - no limit)
+    unsigned speedLimit() const { return speed_limit_; }
+
+    // Estimated highest speed meeting the SLO (0 - unknown)
+    unsigned sustainableSpeed() const { return sustainable_speed_; }
+
+    void reset();
+
+    struct Statistics
+    {
+        bool enabled;
+        unsigned speed_limit;
+        unsigned sustainable_speed;
+        unsigned long decrease_count;
+        unsigned long increase_count;
+        double insert_latency_ms;           // smoothed worst tick latency
+        double acquire_latency_ms;
+        size_t queue_depth;
+    };
+
+    Statistics statistics() const;
+
+private:
+    static constexpr double decrease_factor = 0.7;
+    static constexpr double increase_factor = 1.05;
+    static constexpr double headroom = 0.5;         // raise speed only below half of the SLO
+    static constexpr double smoothing = 0.2;
+    static constexpr unsigned cooldown_ticks = 5;   // no further decrease for a few ticks after a cut
+
+    Settings settings_;
+    std::atomic<bool> enabled_ {false};
+    std::atomic<unsigned> speed_limit_ {0};
+    std::atomic<unsigned> sustainable_speed_ {0};
+    double tick_insert_ms_ {0};                     // worst latencies of the current tick
+    double tick_acquire_ms_ {0};
+    double avg_insert_ms_ {0};
+    double avg_acquire_ms_ {0};
+    size_t last_queue_depth_ {0};
+    unsigned long decrease_count_ {0};
+    unsigned long increase_count_ {0};
+    unsigned cooldown_ {0};
+    std::mutex mutable mtx_;
+};
+
+#endif //ZELEZARNA_SPEEDGOVERNOR_H
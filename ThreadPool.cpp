@@ -0,0 +1,234 @@
+#include "ThreadPool.h"
+
+namespace {
+
+thread_local ThreadPool const* current_pool = nullptr;
+thread_local int current_worker_index = -1;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t n_threads, std::string name)
+    : Object(std::move(name))
+{
+    if (n_threads == 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    workers_.reserve(n_threads);
+    for (size_t i = 0; i < n_threads; ++i)
+        workers_.emplace_back(std::make_unique<Worker>());
+
+    threads_.reserve(n_threads);
+    for (size_t i = 0; i < n_threads; ++i)
+        threads_.emplace_back([this, i] { workerTask(i); });
+
+    log(debug) << "started " << n_threads << " worker threads";
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+}
+
+bool ThreadPool::submit(Task&& task)
+{
+    if (!admit())
+        return false;
+
+    int index = workerIndex();
+    size_t target = index >= 0 ? static_cast<size_t>(index) : next_worker_++ % workers_.size();
+
+    {
+        std::lock_guard lock(workers_[target]->mtx);
+        workers_[target]->queue.push_back(std::move(task));
+    }
+    cv_.notify_one();
+    return true;
+}
+
+bool ThreadPool::defer(Task&& task)
+{
+    if (!admit())
+        return false;
+
+    {
+        std::lock_guard lock(deferred_.mtx);
+        deferred_.queue.push_back(std::move(task));
+    }
+    cv_.notify_one();
+    return true;
+}
+
+bool ThreadPool::admit()
+{
+    // counted before it can be popped (a worker decrements pending_ on pop)
+    std::lock_guard lock(mtx_);
+    if (stop_ && workerIndex() < 0) {
+        log(warning) << "pool stopped, task discarded";
+        return false;
+    }
+    ++pending_;
+    return true;
+}
+
+int ThreadPool::workerIndex() const
+{
+    return current_pool == this ? current_worker_index : -1;
+}
+
+void ThreadPool::stop()
+{
+    {
+        std::lock_guard lock(mtx_);
+        if (stop_)
+            return;
+        stop_ = true;
+    }
+    cv_.notify_all();
+
+    for (auto& thr : threads_) {
+        if (thr.joinable())
+            thr.join();
+    }
+
+    log(debug) << "stopped";
+}
+
+void ThreadPool::workerTask(size_t index)
+{
+    current_pool = this;
+    current_worker_index = static_cast<int>(index);
+
+    Task task;
+
+    while (true) {
+        {
+            std::unique_lock lock(mtx_);
+            cv_.wait(lock, [this] { return stop_ || pending_ > 0; });
+            if (stop_ && pending_ == 0)
+                break;
+        }
+
+        if (popTask(index, task)) {
+            try {
+                task();
+            }
+            catch (std::exception& e) {
+                log(error) << "task exception : " << e.what();
+            }
+            task = nullptr;
+        }
+        else {
+            // another worker took the task in the meantime
+            std::this_thread::yield();
+        }
+    }
+
+    current_pool = nullptr;
+    current_worker_index = -1;
+}
+
+bool ThreadPool::popTask(size_t index, Task& task)
+{
+    // Own queue first (newest task)
+    {
+        auto& w = *workers_[index];
+        std::lock_guard lock(w.mtx);
+        if (!w.queue.empty()) {
+            task = std::move(w.queue.back());
+            w.queue.pop_back();
+            --pending_;
+            return true;
+        }
+    }
+
+    // Deferred tasks in order
+    {
+        std::lock_guard lock(deferred_.mtx);
+        if (!deferred_.queue.empty()) {
+            task = std::move(deferred_.queue.front());
+            deferred_.queue.pop_front();
+            --pending_;
+            return true;
+        }
+    }
+
+    // Steal the oldest task from the others
+    for (size_t i = 1; i < workers_.size(); ++i) {
+        auto& w = *workers_[(index + i) % workers_.size()];
+        std::lock_guard lock(w.mtx);
+        if (!w.queue.empty()) {
+            task = std::move(w.queue.front());
+            w.queue.pop_front();
+            --pending_;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+Strand::~Strand()
+{
+    std::unique_lock lock(mtx_);
+    idle_cv_.wait(lock, [this] { return !running_; });
+}
+
+void Strand::post(ThreadPool::Task&& task)
+{
+    std::unique_lock lock(mtx_);
+    queue_.push_back(std::move(task));
+
+    if (running_)
+        return;
+
+    running_ = true;
+    lock.unlock();
+
+    if (!pool_.submit([this] { drain(); })) {
+        // nothing would run the queue, waiting destructor must not hang
+        std::deque<ThreadPool::Task> discarded;
+        lock.lock();
+        discarded.swap(queue_);
+        running_ = false;
+        idle_cv_.notify_all();
+        lock.unlock();
+    }
+}
+
+size_t Strand::pendingTasks() const
+{
+    std::lock_guard lock(mtx_);
+    return queue_.size();
+}
+
+void Strand::drain()
+{
+    for (size_t n = 0; ; ++n) {
+        ThreadPool::Task task;
+        {
+            std::lock_guard lock(mtx_);
+            if (queue_.empty()) {
+                running_ = false;
+                idle_cv_.notify_all();
+                return;
+            }
+
+            if (n == max_batch) {
+                // continue behind the tasks queued meanwhile (a submit from the worker would be
+                // popped first again), keep running_ set so the order is preserved
+                pool_.defer([this] { drain(); });
+                return;
+            }
+
+            task = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        try {
+            task();
+        }
+        catch (std::exception& e) {
+            Log("Strand", error) << "task exception : " << e.what();
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef ZELEZARNA_THREADPOOL_H
+#define ZELEZARNA_THREADPOOL_H
+
+#include "Object.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size thread pool with per worker task queues and work stealing.
+// Tasks submitted from a worker thread go to its own queue (LIFO for the owner),
+// idle workers steal from the front of the other queues. Deferred tasks go to a shared
+// FIFO queue which workers check after their own queue.
+class ThreadPool : public Object
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(size_t n_threads, std::string name = "ThreadPool");
+
+    ThreadPool(ThreadPool const&) = delete;
+
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    ~ThreadPool() override;
+
+    // Tasks submitted after stop from other threads are discarded and false is returned
+    // (workers still finish theirs)
+    bool submit(Task&& task);
+
+    // Queues the task behind the tasks already queued on the calling worker (continuation of
+    // work that gives the worker to other tasks). Same stop rules as submit.
+    bool defer(Task&& task);
+
+    size_t size() const { return workers_.size(); }
+
+    size_t pendingTasks() const { return pending_; }
+
+    // Index of the calling worker thread in this pool or -1 if called from another thread
+    int workerIndex() const;
+
+    // Finish all queued tasks and join worker threads
+    void stop();
+
+private:
+    struct Worker
+    {
+        std::deque<Task> queue;
+        std::mutex mtx;
+    };
+
+    // Counts the task as pending unless the pool is stopped
+    bool admit();
+
+    void workerTask(size_t index);
+
+    bool popTask(size_t index, Task& task);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    Worker deferred_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_worker_ {0};
+    std::atomic<size_t> pending_ {0};
+    std::atomic<bool> stop_ {false};
+    std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+// Serial executor on top of the thread pool. Tasks posted to the same strand run one at a time
+// in posting order, tasks of different strands run in parallel on the pool workers.
+class Strand
+{
+public:
+    explicit Strand(ThreadPool& pool)
+        : pool_(pool)
+    {}
+
+    // Waits until the task in progress is finished (queued tasks must be drained before)
+    ~Strand();
+
+    Strand(Strand const&) = delete;
+
+    Strand& operator=(Strand const&) = delete;
+
+    // Tasks posted after the pool is stopped are discarded
+    void post(ThreadPool::Task&& task);
+
+    size_t pendingTasks() const;
+
+    // Max number of tasks run in one pool task before giving workers to other strands
+    static constexpr size_t max_batch = 16;
+
+private:
+    void drain();
+
+    ThreadPool& pool_;
+    std::deque<ThreadPool::Task> queue_;
+    bool running_ {false};
+    std::mutex mutable mtx_;
+    std::condition_variable idle_cv_;
+};
+
+#endif //ZELEZARNA_THREADPOOL_H
@@ -1,8 +1,16 @@
 #include "TimeReference.h"
-#include "Application.h"
 
+#include <algorithm>
 #include <iomanip>
 
+TimeReference::~TimeReference()
+{
+    do_run_ = false;
+    ticks_cv_.notify_all();
+    if (thr_.joinable())
+        thr_.join();
+}
+
 void TimeReference::start(TimePoint start_time)
 {
     do_run_ = false;
@@ -12,28 +20,149 @@ void TimeReference::start(TimePoint start_time)
     pause_ = false;
     do_run_ = true;
     thr_ = std::thread([this, start_time]{ workerTask(start_time); });
-    Application::instance().onSimulationChanged();
+    notifyChanged();
 }
 
 void TimeReference::stop()
 {
     do_run_ = false;
+    {
+        std::lock_guard lock(ticks_mtx_);
+    }
+    ticks_cv_.notify_all();
     if (thr_.joinable())
         thr_.join();
-    Application::instance().onSimulationChanged();
+    notifyChanged();
 }
 
 void TimeReference::pause(bool val)
 {
     pause_ = val;
-    Application::instance().onSimulationChanged();
+    notifyChanged();
 }
 
 void TimeReference::setSpeed(unsigned int s)
 {
     speed_ = s;
     log(info) << "speed changed " << s;
-    Application::instance().onSimulationChanged();
+    notifyChanged();
+}
+
+void TimeReference::setTickPeriod(std::chrono::milliseconds period)
+{
+    using namespace std::chrono_literals;
+
+    tick_period_ = std::clamp(period, std::chrono::milliseconds(50ms), std::chrono::milliseconds(1000ms));
+    log(info) << "tick period changed " << tick_period_.load().count() << " ms";
+    notifyChanged();
+}
+
+void TimeReference::setMode(Mode m)
+{
+    mode_ = m;
+    log(info) << "mode changed " << modeToString(m);
+    {
+        std::lock_guard lock(ticks_mtx_);
+    }
+    ticks_cv_.notify_all();
+    notifyChanged();
+}
+
+std::string_view TimeReference::modeToString(Mode m)
+{
+    switch (m) {
+        case Mode::realtime: return "realtime";
+        case Mode::replay: return "replay";
+        default: return "unknown";
+    }
+}
+
+TimeReference::Mode TimeReference::modeFromString(std::string_view m)
+{
+    if (m == "realtime")
+        return Mode::realtime;
+    else if (m == "replay")
+        return Mode::replay;
+
+    throw std::runtime_error("unknown simulation mode '" + std::string(m) + "'");
+}
+
+void TimeReference::tickStarted()
+{
+    std::lock_guard lock(ticks_mtx_);
+    ++ticks_in_flight_;
+    tick_start_times_.push_back(std::chrono::steady_clock::now());
+    tick_stat_.ticks_count++;
+}
+
+void TimeReference::tickFinished(size_t rows)
+{
+    {
+        std::lock_guard lock(ticks_mtx_);
+        if (ticks_in_flight_ > 0)
+            --ticks_in_flight_;
+        tick_rows_ += rows;
+
+        // ticks finish in dispatch order
+        if (!tick_start_times_.empty()) {
+            double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - tick_start_times_.front()).count();
+            tick_start_times_.pop_front();
+
+            auto& st = tick_stat_;
+            st.ticks_finished++;
+            st.last_duration_ms = ms;
+            st.max_duration_ms = std::max(st.max_duration_ms, ms);
+            st.avg_duration_ms += (ms - st.avg_duration_ms) / static_cast<double>(st.ticks_finished);
+            if (mode_ == Mode::realtime && ms > static_cast<double>(tick_period_.load().count()))
+                st.deadline_miss_count++;
+        }
+    }
+    ticks_cv_.notify_all();
+}
+
+void TimeReference::setOverrunPolicy(OverrunPolicy p)
+{
+    overrun_policy_ = p;
+    log(info) << "overrun policy changed " << overrunPolicyToString(p);
+    notifyChanged();
+}
+
+std::string_view TimeReference::overrunPolicyToString(OverrunPolicy p)
+{
+    switch (p) {
+        case OverrunPolicy::queue: return "queue";
+        case OverrunPolicy::skip: return "skip";
+        case OverrunPolicy::merge: return "merge";
+        case OverrunPolicy::slow: return "slow";
+        default: return "unknown";
+    }
+}
+
+TimeReference::OverrunPolicy TimeReference::overrunPolicyFromString(std::string_view p)
+{
+    if (p == "queue")
+        return OverrunPolicy::queue;
+    else if (p == "skip")
+        return OverrunPolicy::skip;
+    else if (p == "merge")
+        return OverrunPolicy::merge;
+    else if (p == "slow")
+        return OverrunPolicy::slow;
+
+    throw std::runtime_error("unknown overrun policy '" + std::string(p) + "'");
+}
+
+TimeReference::TickStatistics TimeReference::tickStatistics() const
+{
+    std::lock_guard lock(ticks_mtx_);
+    return tick_stat_;
+}
+
+void TimeReference::resetTickStatistics()
+{
+    std::lock_guard lock(ticks_mtx_);
+    tick_stat_ = {};
 }
 
 std::string TimeReference::status() const
@@ -50,15 +179,18 @@ void TimeReference::registerPingCallback(void* handle, std::function<void(TimePo
 {
     log(debug) << "Register callback " << handle;
     std::lock_guard lock(ping_callback_mtx_);
-    ping_callback_[handle] = std::move(cb);
+    auto callbacks = std::make_shared<CallbackMap>(*ping_callback_.load());
+    (*callbacks)[handle] = std::move(cb);
+    ping_callback_ = std::move(callbacks);
 }
 
 void TimeReference::unregisterPingCallback(void* handle)
 {
     log(debug) << "Unregister callback " << handle;
     std::lock_guard lock(ping_callback_mtx_);
-    if (auto p = ping_callback_.find(handle); p != ping_callback_.end())
-        ping_callback_.erase(p);
+    auto callbacks = std::make_shared<CallbackMap>(*ping_callback_.load());
+    if (callbacks->erase(handle))
+        ping_callback_ = std::move(callbacks);
 }
 
 std::string TimeReference::timeStamp(TimePoint tp)
@@ -83,27 +215,184 @@ void TimeReference::workerTask(TimePoint start_time)
 
     sim_time_ = start_time;
     auto ctrl_time = ClockType::now();
+    rate_wall_time_ = std::chrono::steady_clock::now();
+    rate_sim_time_ = sim_time_;
+    sim_rate_ = 0;
+
+    // replay rows limit accounting
+    auto limit_begin = std::chrono::steady_clock::now();
+    double limit_rows = 0;
 
     while (do_run_) {
-        double sleep_time = 1000;
-        auto tp2 = ctrl_time + std::chrono::milliseconds(static_cast<int>(sleep_time));
+
+        if (mode_ == Mode::replay) {
+            if (pause_) {
+                std::this_thread::sleep_for(100ms);
+                limit_begin = std::chrono::steady_clock::now();
+                limit_rows = 0;
+                continue;
+            }
+
+            dispatchPing();
+            waitTicksFinished();
+
+            // optional throughput cap - wait until rows written so far fit into the limit
+            double limit = replay_rows_limit_;
+            {
+                std::lock_guard lock(ticks_mtx_);
+                limit_rows += tick_rows_;
+                tick_rows_ = 0;
+            }
+            if (limit > 0) {
+                std::this_thread::sleep_until(limit_begin + std::chrono::microseconds(
+                        static_cast<long long>(limit_rows / limit * 1e6)));
+            }
+            else {
+                limit_begin = std::chrono::steady_clock::now();
+                limit_rows = 0;
+            }
+
+            sim_time_ += tickAdvance();
+            ctrl_time = ClockType::now();
+            updateSimRate(std::chrono::steady_clock::now());
+            continue;
+        }
+
+        auto tp2 = ctrl_time + tick_period_.load();
+        bool advance = true;
 
         if (!pause_) {
-            log(debug) << "ping - now : " << timeStamp(ClockType::now()) << " simulator time : "
-                         << timeStamp(sim_time_);
+            auto policy = overrun_policy_.load();
+
+            bool overrun = ticksInFlight();
 
-            std::lock_guard lock(ping_callback_mtx_);
-            for (auto &cb: ping_callback_)
-                cb.second(sim_time_);
+            if (overrun) {
+                std::lock_guard lock(ticks_mtx_);
+                tick_stat_.overrun_count++;
+            }
+
+            if (!overrun || policy == OverrunPolicy::queue) {
+                dispatchPing();
+            }
+            else {
+                log(debug) << "tick overrun at simulator time " << timeStamp(sim_time_) << " policy " << overrunPolicyToString(policy);
+
+                if (policy == OverrunPolicy::skip) {
+                    std::lock_guard lock(ticks_mtx_);
+                    tick_stat_.skipped_count++;
+                }
+                else if (policy == OverrunPolicy::merge) {
+                    // dispatch the merged interval as soon as the pipeline gets free within this period
+                    {
+                        std::lock_guard lock(ticks_mtx_);
+                        tick_stat_.merged_count++;
+                    }
+                    if (waitTicksFinishedUntil(tp2) && do_run_ && !pause_)
+                        dispatchPing();
+                }
+                else if (policy == OverrunPolicy::slow) {
+                    advance = false;
+                    std::lock_guard lock(ticks_mtx_);
+                    tick_stat_.slowed_count++;
+                    tick_stat_.sim_time_held_s += std::chrono::duration<double>(tickAdvance()).count();
+                }
+            }
         }
 
         std::this_thread::sleep_until(tp2);
         ctrl_time = tp2;
 
-        if (!pause_) {
-            sim_time_ += std::chrono::seconds(speed_);
+        if (!pause_ && advance) {
+            sim_time_ += tickAdvance();
         }
+
+        {
+            std::lock_guard lock(ticks_mtx_);
+            tick_rows_ = 0;
+        }
+        updateSimRate(std::chrono::steady_clock::now());
     }
 
     log(info) << "task finished";
-}
\ No newline at end of file
+}
+
+void TimeReference::dispatchPing()
+{
+    log(debug) << "ping - now : " << timeStamp(ClockType::now()) << " simulator time : "
+               << timeStamp(sim_time_);
+
+    // callbacks only submit the tick work (each clock has one subscriber - its run)
+    auto callbacks = ping_callback_.load();
+    for (auto const& cb : *callbacks)
+        cb.second(sim_time_);
+}
+
+void TimeReference::waitIdle()
+{
+    std::unique_lock lock(ticks_mtx_);
+    ticks_cv_.wait(lock, [this] {
+        return ticks_in_flight_ == 0;
+    });
+}
+
+bool TimeReference::waitIdleUntil(std::chrono::steady_clock::time_point deadline)
+{
+    std::unique_lock lock(ticks_mtx_);
+    return ticks_cv_.wait_until(lock, deadline, [this] {
+        return ticks_in_flight_ == 0;
+    });
+}
+
+void TimeReference::notifyChanged() const
+{
+    if (changed_callback_)
+        changed_callback_();
+}
+
+void TimeReference::waitTicksFinished()
+{
+    std::unique_lock lock(ticks_mtx_);
+    ticks_cv_.wait(lock, [this] {
+        return ticks_in_flight_ == 0 || !do_run_ || mode_ != Mode::replay;
+    });
+}
+
+ClockType::duration TimeReference::tickAdvance() const
+{
+    return std::chrono::duration_cast<ClockType::duration>(tick_period_.load() * effectiveSpeed());
+}
+
+unsigned int TimeReference::effectiveSpeed() const
+{
+    unsigned int limit = speed_limit_;
+    return limit ? std::min(speed_, limit) : speed_;
+}
+
+bool TimeReference::ticksInFlight()
+{
+    std::lock_guard lock(ticks_mtx_);
+    return ticks_in_flight_ > 0;
+}
+
+bool TimeReference::waitTicksFinishedUntil(std::chrono::system_clock::time_point deadline)
+{
+    std::unique_lock lock(ticks_mtx_);
+    return ticks_cv_.wait_until(lock, deadline, [this] {
+        return ticks_in_flight_ == 0 || !do_run_;
+    }) && ticks_in_flight_ == 0;
+}
+
+void TimeReference::updateSimRate(std::chrono::steady_clock::time_point now)
+{
+    auto elapsed = now - rate_wall_time_;
+    if (elapsed < std::chrono::seconds(1))
+        return;
+
+    double wall_s = std::chrono::duration<double>(elapsed).count();
+    double sim_s = std::chrono::duration<double>(sim_time_ - rate_sim_time_).count();
+    sim_rate_ = sim_s / wall_s;
+    rate_wall_time_ = now;
+    rate_sim_time_ = sim_time_;
+
+    log(debug) << "simulation rate " << sim_rate_ << " sim s / s";
+}
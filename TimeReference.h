@@ -6,20 +6,55 @@
 #include <chrono>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <unordered_map>
 
 using ClockType = std::chrono::system_clock;
 using TimePoint = ClockType::time_point;
 
+// Simulation clock of one simulation run
 class TimeReference : public Object
 {
-private:
+public:
+
+    enum class Mode
+    {
+        realtime,   // one tick per wall clock second
+        replay      // next tick as soon as the previous tick is processed
+    };
+
+    // What to do when the previous tick is still being processed at the next tick deadline (realtime mode)
+    enum class OverrunPolicy
+    {
+        queue,      // dispatch anyway (ticks queue up)
+        skip,       // drop the tick, the next scheduled tick covers the interval
+        merge,      // drop the tick and dispatch the accumulated interval as soon as the pipeline is free
+        slow        // hold the simulation clock until the pipeline is free
+    };
+
+    struct TickStatistics
+    {
+        unsigned long ticks_count;          // dispatched ticks
+        unsigned long ticks_finished;       // ticks with all work finished
+        unsigned long overrun_count;        // previous tick still in progress at the tick deadline
+        unsigned long deadline_miss_count;  // tick processing took longer than the tick period
+        unsigned long skipped_count;
+        unsigned long merged_count;
+        unsigned long slowed_count;
+        double last_duration_ms;
+        double avg_duration_ms;
+        double max_duration_ms;
+        double sim_time_held_s;             // simulation time not advanced by slow policy
+    };
 
     TimeReference()
         : Object("TimeReference")
     {}
 
-public:
+    ~TimeReference() override;
 
     TimeReference(const TimeReference&) = delete;
 
@@ -29,11 +64,8 @@ public:
 
     TimeReference& operator=(TimeReference&&) = delete;
 
-    static TimeReference& instance()
-    {
-        static TimeReference instance;
-        return instance;
-    }
+    // Called on start / stop / settings changes. Must be set while the timer is stopped.
+    void setChangedCallback(std::function<void()>&& cb) { changed_callback_ = std::move(cb); }
 
     void start(TimePoint start_time);
 
@@ -45,12 +77,62 @@ public:
 
     void setSpeed(unsigned int s);
 
+    // Upper limit of the effective speed set by the speed governor (0 - no limit)
+    void setSpeedLimit(unsigned int limit) { speed_limit_ = limit; }
+
+    unsigned int effectiveSpeed() const;
+
+    auto tickPeriod() const { return tick_period_.load(); }
+
+    // Wall clock tick period (limited to 50 - 1000 ms), simulation time advances speed * period per tick
+    void setTickPeriod(std::chrono::milliseconds period);
+
     auto simulatorCurrentTime() const { return sim_time_; }
 
     auto simulatorCurrentUnixtime() const { return ClockType::to_time_t(sim_time_); }
 
     std::string status() const;
 
+    Mode mode() const { return mode_; }
+
+    void setMode(Mode m);
+
+    static std::string_view modeToString(Mode m);
+
+    static Mode modeFromString(std::string_view m);
+
+    // Replay mode rows/sec limit (0 - unlimited)
+    void setReplayRowsLimit(double rows_per_sec) { replay_rows_limit_ = rows_per_sec; }
+
+    auto replayRowsLimit() const { return replay_rows_limit_.load(); }
+
+    OverrunPolicy overrunPolicy() const { return overrun_policy_; }
+
+    void setOverrunPolicy(OverrunPolicy p);
+
+    static std::string_view overrunPolicyToString(OverrunPolicy p);
+
+    static OverrunPolicy overrunPolicyFromString(std::string_view p);
+
+    TickStatistics tickStatistics() const;
+
+    void resetTickStatistics();
+
+    // Achieved simulation seconds per wall clock second
+    double simRate() const { return sim_rate_; }
+
+    // Tick processing tracking - ping subscriber calls tickStarted() from the ping callback
+    // and tickFinished() when all tick work is done (replay mode waits for it)
+    void tickStarted();
+
+    void tickFinished(size_t rows);
+
+    // Wait until all dispatched ticks are finished (regardless of mode and timer state)
+    void waitIdle();
+
+    // Wait for ticks in progress until the deadline, returns true if all ticks finished
+    bool waitIdleUntil(std::chrono::steady_clock::time_point deadline);
+
     void registerPingCallback(void* handle, std::function<void(TimePoint)>&& cb);
 
     void unregisterPingCallback(void* handle);
@@ -60,14 +142,47 @@ public:
 private:
     void workerTask(TimePoint start_time);
 
+    void dispatchPing();
+
+    void notifyChanged() const;
+
+    void waitTicksFinished();
+
+    bool ticksInFlight();
+
+    // Wait until pipeline is free or the deadline passes, returns true if pipeline is free
+    bool waitTicksFinishedUntil(std::chrono::system_clock::time_point deadline);
+
+    void updateSimRate(std::chrono::steady_clock::time_point now);
+
+    ClockType::duration tickAdvance() const;
+
     unsigned int speed_ {1};
+    std::atomic<unsigned int> speed_limit_ {0};
     std::chrono::milliseconds offset_;
     std::thread thr_;
     std::atomic<bool> do_run_;
     std::atomic<bool> pause_ {false};
+    std::atomic<std::chrono::milliseconds> tick_period_ {std::chrono::milliseconds(1000)};
+    std::atomic<Mode> mode_ {Mode::realtime};
+    std::atomic<double> replay_rows_limit_ {0};
+    std::atomic<double> sim_rate_ {0};
+    std::chrono::steady_clock::time_point rate_wall_time_;
+    TimePoint rate_sim_time_;
+    std::atomic<OverrunPolicy> overrun_policy_ {OverrunPolicy::queue};
+    size_t ticks_in_flight_ {0};
+    size_t tick_rows_ {0};
+    std::deque<std::chrono::steady_clock::time_point> tick_start_times_;
+    TickStatistics tick_stat_ {};
+    std::mutex mutable ticks_mtx_;
+    std::condition_variable ticks_cv_;
     ClockType::time_point sim_time_;
-    std::unordered_map<void*, std::function<void(TimePoint)>> ping_callback_;
-    std::mutex mutable ping_callback_mtx_;
+    // Copy on write callback list - dispatch reads the current snapshot without locking,
+    // register/unregister publish a modified copy
+    using CallbackMap = std::unordered_map<void*, std::function<void(TimePoint)>>;
+    std::atomic<std::shared_ptr<CallbackMap const>> ping_callback_ {std::make_shared<CallbackMap const>()};
+    std::mutex mutable ping_callback_mtx_; // serializes writers
+    std::function<void()> changed_callback_;
 };
 
 
@@ -0,0 +1,212 @@
+#include "TimerWheel.h"
+
+#include <algorithm>
+#include <queue>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+TimePoint fromUtc(std::tm& tm)
+{
+    return ClockType::from_time_t(timegm(&tm));
+}
+
+std::tm toUtc(TimePoint tp)
+{
+    time_t t = ClockType::to_time_t(tp);
+    std::tm tm = {};
+    gmtime_r(&t, &tm);
+    return tm;
+}
+
+int daysInMonth(int year, int month)
+{
+    static constexpr int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return month == 1 && leap ? 29 : days[month];
+}
+
+} // namespace
+
+TimerWheel::TimerWheel(ClockType::duration resolution, size_t slots)
+    : Object("TimerWheel")
+    , resolution_(resolution)
+    , slots_(std::max<size_t>(slots, 1))
+{
+}
+
+void TimerWheel::reset(TimePoint now)
+{
+    for (auto& slot : slots_)
+        slot.clear();
+    events_.clear();
+    now_ = now;
+}
+
+TimerWheel::Id TimerWheel::schedule(TimePoint due, Callback&& cb, Recurrence&& recurrence)
+{
+    Id id = next_id_++;
+    events_.emplace(id, Event{due, std::move(cb), std::move(recurrence)});
+    insert(id, due);
+    return id;
+}
+
+void TimerWheel::cancel(Id id)
+{
+    // slot entry is dropped when its slot is processed
+    events_.erase(id);
+}
+
+size_t TimerWheel::advance(TimePoint to)
+{
+    if (to < now_)
+        return 0;
+
+    size_t fired = 0;
+    long long n = static_cast<long long>(slots_.size());
+    long long end = slotTick(to);
+
+    for (long long k = slotTick(now_); k <= end && !events_.empty(); ++k) {
+
+        // more than one turn ahead - continue with the slot of the first due event
+        if (end - k >= n) {
+            auto first = std::min_element(events_.begin(), events_.end(), [](auto const& a, auto const& b) {
+                return a.second.due < b.second.due;
+            })->second.due;
+
+            if (first > to)
+                break;
+            k = std::max(k, slotTick(first));
+        }
+
+        auto& slot = slots_[((k % n) + n) % n];
+
+        // due events of this slot in due order, entries of later rounds stay in the slot
+        std::priority_queue<SlotEntry, std::vector<SlotEntry>, std::greater<>> due;
+        std::vector<SlotEntry> keep;
+
+        for (auto const& e : slot) {
+            auto it = events_.find(e.id);
+            if (it == events_.end() || it->second.due != e.due)
+                continue; // cancelled or fired
+
+            if (e.due <= to && slotTick(e.due) <= k)
+                due.push(e);
+            else
+                keep.push_back(e);
+        }
+        slot.swap(keep);
+
+        while (!due.empty()) {
+            auto e = due.top();
+            due.pop();
+
+            auto it = events_.find(e.id);
+            if (it == events_.end() || it->second.due != e.due)
+                continue; // cancelled by an earlier callback
+
+            now_ = std::max(now_, e.due);
+            auto cb = it->second.cb;
+
+            if (it->second.recurrence) {
+                auto next = it->second.recurrence(e.due);
+                if (next > e.due) {
+                    it->second.due = next;
+                    insert(e.id, next);
+                    if (next <= to && slotTick(next) <= k)
+                        due.push({next, e.id});
+                }
+                else {
+                    log(error) << "recurrence of event " << e.id << " does not advance - event removed";
+                    events_.erase(it);
+                }
+            }
+            else {
+                events_.erase(it);
+            }
+
+            cb(e.due);
+            ++fired;
+        }
+    }
+
+    now_ = to;
+    return fired;
+}
+
+long long TimerWheel::slotTick(TimePoint tp) const
+{
+    auto d = tp.time_since_epoch();
+    return d / resolution_ - (d % resolution_ < ClockType::duration::zero());
+}
+
+void TimerWheel::insert(Id id, TimePoint due)
+{
+    // overdue events go to the current slot
+    long long n = static_cast<long long>(slots_.size());
+    long long k = slotTick(std::max(due, now_));
+    slots_[((k % n) + n) % n].push_back({due, id});
+}
+
+TimerWheel::Recurrence TimerWheel::every(ClockType::duration period)
+{
+    return [period](TimePoint due) {
+        return due + period;
+    };
+}
+
+TimerWheel::Recurrence TimerWheel::monthly()
+{
+    return [](TimePoint due) {
+        auto tm = toUtc(due);
+        int mday = tm.tm_mday;
+        tm.tm_mday = 1;
+        if (++tm.tm_mon == 12) {
+            tm.tm_mon = 0;
+            tm.tm_year++;
+        }
+        tm.tm_mday = std::min(mday, daysInMonth(tm.tm_year + 1900, tm.tm_mon));
+        return fromUtc(tm);
+    };
+}
+
+TimePoint TimerWheel::timeOfDay(TimePoint tp, int hour)
+{
+    auto tm = toUtc(tp);
+    tm.tm_hour = hour;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    return fromUtc(tm);
+}
+
+TimePoint TimerWheel::nextTimeOfDay(TimePoint tp, int hour)
+{
+    auto result = timeOfDay(tp, hour);
+    return result < tp ? result + 24h : result;
+}
+
+TimePoint TimerWheel::nextWeekday(TimePoint tp, int weekday, int hour)
+{
+    auto result = nextTimeOfDay(tp, hour);
+    int wday = toUtc(result).tm_wday;
+    return result + 24h * ((weekday - wday + 7) % 7);
+}
+
+TimePoint TimerWheel::nextMonth(TimePoint tp, int hour)
+{
+    auto tm = toUtc(tp);
+    tm.tm_mday = 1;
+    tm.tm_hour = hour;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    auto result = fromUtc(tm);
+    if (result < tp) {
+        if (++tm.tm_mon == 12) {
+            tm.tm_mon = 0;
+            tm.tm_year++;
+        }
+        result = fromUtc(tm);
+    }
+    return result;
+}
@@ -0,0 +1,89 @@
+#ifndef ZELEZARNA_TIMERWHEEL_H
+#define ZELEZARNA_TIMERWHEEL_H
+
+#include "Object.h"
+#include "TimeReference.h"
+#include <functional>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// Simulation time timer wheel for scheduled and recurring events.
+// Events are hashed into slots by due time (slot resolution, events further than one wheel
+// turn stay in their slot until their round comes). advance() fires every event due up to
+// the given time in due time order (ties in scheduling order), including several occurrences
+// of a recurring event when a tick spans more than one period. Long jumps skip empty slots.
+// Not thread safe - schedule and advance from one thread / strand.
+class TimerWheel : public Object
+{
+public:
+    using Id = unsigned long;
+    using Callback = std::function<void(TimePoint due)>;
+
+    // Returns the next due time of a recurring event (empty - one shot event)
+    using Recurrence = std::function<TimePoint(TimePoint due)>;
+
+    explicit TimerWheel(ClockType::duration resolution = std::chrono::hours(1), size_t slots = 256);
+
+    // Removes all events and sets current time
+    void reset(TimePoint now);
+
+    Id schedule(TimePoint due, Callback&& cb, Recurrence&& recurrence = {});
+
+    void cancel(Id id);
+
+    // Fires all events due up to time to, returns number of fired events
+    size_t advance(TimePoint to);
+
+    size_t size() const { return events_.size(); }
+
+    TimePoint now() const { return now_; }
+
+    static Recurrence every(ClockType::duration period);
+
+    // Same time on the same day of the next month (UTC, day clamped to the month length)
+    static Recurrence monthly();
+
+    // hour:00 UTC on the day of tp
+    static TimePoint timeOfDay(TimePoint tp, int hour);
+
+    // First time at hour:00 UTC not before tp
+    static TimePoint nextTimeOfDay(TimePoint tp, int hour);
+
+    // First time at hour:00 UTC on weekday (0 - sunday) not before tp
+    static TimePoint nextWeekday(TimePoint tp, int weekday, int hour);
+
+    // First time at hour:00 UTC on the first day of a month not before tp
+    static TimePoint nextMonth(TimePoint tp, int hour);
+
+private:
+    struct Event
+    {
+        TimePoint due;
+        Callback cb;
+        Recurrence recurrence;
+    };
+
+    struct SlotEntry
+    {
+        TimePoint due;
+        Id id;
+
+        bool operator>(SlotEntry const& other) const
+        {
+            return std::tie(due, id) > std::tie(other.due, other.id);
+        }
+    };
+
+    long long slotTick(TimePoint tp) const;
+
+    void insert(Id id, TimePoint due);
+
+    ClockType::duration resolution_;
+    std::vector<std::vector<SlotEntry>> slots_;
+    std::unordered_map<Id, Event> events_;
+    TimePoint now_;
+    Id next_id_ {1};
+};
+
+#endif //ZELEZARNA_TIMERWHEEL_H
@@ -3,6 +3,13 @@
 
 #include <functional>
 
+// Value at x on the line through (x1, y1) and (x2, y2)
+template<typename Tx, typename Ty>
+Ty lin_interpolate(Tx x, Tx x1, Tx x2, Ty y1, Ty y2)
+{
+    return (y2 - y1) / (x2 - x1) * (x - x1) + y1;
+}
+
 template<typename Func>
 class Finally
 {
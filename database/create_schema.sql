@@ -10,36 +10,44 @@ FLUSH PRIVILEGES;
 
 DELIMITER $$
 
+-- Data of concurrent simulation runs is kept apart by run_id, every run has its own
+-- partition (r<run_id>, created by the application) so run data is reset with
+-- TRUNCATE PARTITION instead of deleting rows
+
 CREATE TABLE zelezarna.energy_data (
+  `run_id` INT UNSIGNED NOT NULL DEFAULT 0,
   `time` TIMESTAMP NOT NULL,
   `energy` double DEFAULT NULL,
-  PRIMARY KEY (`time`),
+  PRIMARY KEY (`run_id`, `time`),
   INDEX (`energy`)
+)
+PARTITION BY LIST (`run_id`) (
+  PARTITION r0 VALUES IN (0)
 );
 
-CREATE FUNCTION zelezarna.upsert_energy(ptime BIGINT, pval DOUBLE)
+CREATE FUNCTION zelezarna.upsert_energy(prun INT UNSIGNED, ptime BIGINT, pval DOUBLE)
 RETURNS INT DETERMINISTIC 
 BEGIN
         INSERT INTO energy_data
-        VALUES (FROM_UNIXTIME(ptime), pval)
+        VALUES (prun, FROM_UNIXTIME(ptime), pval)
         ON DUPLICATE KEY UPDATE `time`=FROM_UNIXTIME(ptime), energy=pval;
         RETURN 1;
 END;
 
-CREATE PROCEDURE zelezarna.get_energy(pfrom BIGINT, pto BIGINT)
+CREATE PROCEDURE zelezarna.get_energy(prun INT UNSIGNED, pfrom BIGINT, pto BIGINT)
 BEGIN
         (SELECT time, UNIX_TIMESTAMP(time) AS unixtime, energy FROM zelezarna.energy_data
-        WHERE UNIX_TIMESTAMP(time)<pfrom AND energy IS NOT NULL ORDER BY time DESC LIMIT 1)
+        WHERE run_id=prun AND UNIX_TIMESTAMP(time)<pfrom AND energy IS NOT NULL ORDER BY time DESC LIMIT 1)
 
         UNION 
 
         (SELECT time, UNIX_TIMESTAMP(time) AS unixtime, energy FROM zelezarna.energy_data
-        WHERE UNIX_TIMESTAMP(time)>=pfrom AND UNIX_TIMESTAMP(time)<=pto AND energy IS NOT NULL)
+        WHERE run_id=prun AND UNIX_TIMESTAMP(time)>=pfrom AND UNIX_TIMESTAMP(time)<=pto AND energy IS NOT NULL)
 
         UNION
 
         (SELECT time, UNIX_TIMESTAMP(time) AS unixtime, energy FROM zelezarna.energy_data
-        WHERE UNIX_TIMESTAMP(time)>pto AND energy IS NOT NULL ORDER BY time ASC LIMIT 1)
+        WHERE run_id=prun AND UNIX_TIMESTAMP(time)>pto AND energy IS NOT NULL ORDER BY time ASC LIMIT 1)
         ;
 END;
 
@@ -52,24 +60,42 @@ $$
 DELIMITER $$
 
 CREATE TABLE zelezarna.production_data (
+  `run_id` INT UNSIGNED NOT NULL DEFAULT 0,
   `time` TIMESTAMP NOT NULL,
   `production` double DEFAULT NULL,
-  PRIMARY KEY (`time`)
+  PRIMARY KEY (`run_id`, `time`)
+)
+PARTITION BY LIST (`run_id`) (
+  PARTITION r0 VALUES IN (0)
 );
 
-CREATE FUNCTION zelezarna.upsert_production(ptime BIGINT, pval DOUBLE)
+CREATE FUNCTION zelezarna.upsert_production(prun INT UNSIGNED, ptime BIGINT, pval DOUBLE)
 RETURNS INT DETERMINISTIC 
 BEGIN
         INSERT INTO production_data
-        VALUES (FROM_UNIXTIME(ptime), pval)
+        VALUES (prun, FROM_UNIXTIME(ptime), pval)
         ON DUPLICATE KEY UPDATE `time`=FROM_UNIXTIME(ptime), production=pval;
         RETURN 1;
 END;
 
-CREATE PROCEDURE zelezarna.get_production(pfrom BIGINT, pto BIGINT)
+CREATE PROCEDURE zelezarna.get_production(prun INT UNSIGNED, pfrom BIGINT, pto BIGINT)
 BEGIN
         SELECT time, UNIX_TIMESTAMP(time) AS unixtime, production FROM zelezarna.production_data
-        WHERE UNIX_TIMESTAMP(time)>pfrom AND UNIX_TIMESTAMP(time)<=pto AND production IS NOT NULL;
+        WHERE run_id=prun AND UNIX_TIMESTAMP(time)>pfrom AND UNIX_TIMESTAMP(time)<=pto AND production IS NOT NULL;
 END;
 
 $$
+
+
+-------------------------------------------------------
+-- Kpi results
+-------------------------------------------------------
+
+CREATE TABLE zelezarna.kpi_results (
+  `run_id` INT UNSIGNED NOT NULL DEFAULT 0,
+  `window_type` ENUM('daily', 'weekly') NOT NULL,
+  `window_end` TIMESTAMP NOT NULL,
+  `value` double DEFAULT NULL,
+  `calc_id` INT UNSIGNED NOT NULL,
+  PRIMARY KEY (`run_id`, `window_type`, `window_end`)
+);
@@ -2,12 +2,21 @@
 let wsocket;
 let chartDaily;
 let calculationId;
+let runId = 0;
 
 function websocketSend(msg) {
     console.debug("websocket sending", msg)
     wsocket.send(msg);
 }
 
+// Simulation command addressed to the selected run
+function runCommand(cmd) {
+    cmd.run_id = runId;
+    websocketSend(JSON.stringify({
+        command: cmd
+    }));
+}
+
 function setSimSpeed(val) {
     $("#simulator-speed").val(val);
 }
@@ -48,6 +57,11 @@ function onKpiWeeklyReceived(data) {
     chartDaily.series[1].addPoint([data.time * 1000, data.value]);
 }
 
+function onKpiHistoryReceived(data) {
+    chartDaily.series[0].setData(data.daily.map(it => [it.time * 1000, it.value]));
+    chartDaily.series[1].setData(data.weekly.map(it => [it.time * 1000, it.value]));
+}
+
 function cleanChart() {
     chartDaily.series[0].setData([]);
     chartDaily.series[1].setData([]);
@@ -84,6 +98,12 @@ function websocketConnect() {
             console.log("websocket message received ", msg.data);
 
             let data = JSON.parse(msg.data);
+            if (data.run_id !== undefined && data.run_id !== runId) {
+                return;
+            }
+            if (data.runs) {
+                console.log("simulation runs", data.runs);
+            }
             if (data.calc_id && data.calc_id !== calculationId) {
                 cleanChart();
                 calculationId = data.calc_id;
@@ -103,6 +123,12 @@ function websocketConnect() {
             if (data.kpi_weekly) {
                 onKpiWeeklyReceived(data.kpi_weekly);
             }
+            if (data.kpi_history) {
+                onKpiHistoryReceived(data.kpi_history);
+            }
+            if (data.command_result && !data.command_result.ok) {
+                console.error("command failed", data.command_result);
+            }
             if (data.operation_statistics) {
                 $("#statistics-view").html(JSON.stringify(data.operation_statistics, null, "  "));
             }
@@ -127,70 +153,110 @@ function websocketConnect() {
 
 $("#button-start").click(function() {
     cleanChart();
-    websocketSend(JSON.stringify({
-        command: {
-            type: "start"
-        }
-    }));
+    runCommand({
+        type: "start"
+    });
 });
 
 $("#button-stop").click(function() {
-    websocketSend(JSON.stringify({
-        command: {
-            type: "stop"
-        }
-    }));
+    runCommand({
+        type: "stop"
+    });
 });
 
 $("#button-pause").click(function() {
-    websocketSend(JSON.stringify({
-        command: {
-            type: "pause"
-        }
-    }));
+    runCommand({
+        type: "pause"
+    });
 });
 
 $("#button-resume").click(function() {
-    websocketSend(JSON.stringify({
-        command: {
-            type: "resume"
-        }
-    }));
+    runCommand({
+        type: "resume"
+    });
 });
 
 $("#simulator-speed").on("change", function() {
-    websocketSend(JSON.stringify({
-        command: {
-            type: "speed",
-            value: parseInt($(this).val())
-        }
-    }));
+    runCommand({
+        type: "speed",
+        value: parseInt($(this).val())
+    });
 })
 
 $("#button-get-statistics").click(function() {
+    runCommand({
+        type: "get_statistics"
+    });
+});
+
+function resetStatistics() {
+    runCommand({
+        type: "reset_statistics"
+    });
+}
+
+function getStatistics() {
+    runCommand({
+        type: "get_statistics"
+    });
+}
+
+function createRun() {
     websocketSend(JSON.stringify({
         command: {
-            type: "get_statistics"
+            type: "create_run"
         }
     }));
-});
+}
 
-function resetStatistics() {
+function selectRun(id) {
+    runId = id;
+    calculationId = undefined;
+    cleanChart();
+    runCommand({
+        type: "get_statistics"
+    });
+}
+
+function closeRun(id) {
     websocketSend(JSON.stringify({
         command: {
-            type: "reset_statistics"
+            type: "close_run",
+            run_id: id
         }
     }));
 }
 
-function getStatistics() {
+// Topics: sim_time, kpi_daily, kpi_weekly, statistics, series_energy, series_production
+function subscribe(topics, on = true) {
     websocketSend(JSON.stringify({
         command: {
-            type: "get_statistics"
+            type: on ? "subscribe" : "unsubscribe",
+            topics: topics
         }
     }));
 }
 
+// source: "stored" (default) or "database" (recalculated through the run kpi cache)
+function getKpiHistory(from, to, source) {
+    runCommand({
+        type: "kpi_history",
+        from: from,
+        to: to,
+        source: source
+    });
+}
+
+function recomputeKpi(from, to, source) {
+    cleanChart();
+    runCommand({
+        type: "recompute",
+        from: from,
+        to: to,
+        source: source
+    });
+}
+
 function setGlobalLoggingLevel(level) {
     websocketSend(JSON.stringify({
         command: {
@@ -1,8 +1,12 @@
 #include "Log.h"
 #include "TimeReference.h"
 #include "Application.h"
+#include "SimulationRun.h"
 #include "webserver/Webserver.h"
+#include "webserver/WebsocketDataBus.h"
+#include "webserver/WebsocketSession.h"
 #include <boost/program_options.hpp>
+#include <iostream>
 
 namespace po = boost::program_options;
 
@@ -23,13 +27,40 @@ int main(int argc, const char* argv[]) try
             ("dbpassword", po::value(&app.options.db_password), "database password")
             ("httpport", po::value<unsigned short>(), "server port")
             ("simspeed", po::value<unsigned int>(), "initial simulation speed")
+            ("tick-period", po::value<unsigned>(), "simulation tick period in ms [50-1000] (default 1000)")
+            ("simmode", po::value<std::string>(), "simulation mode [realtime|replay] (default realtime)")
+            ("speed-governor", "limit simulation speed to the speed sustainable by the database")
+            ("overrun-policy", po::value<std::string>(), "realtime tick overrun policy [queue|skip|merge|slow] (default queue)")
+            ("replay-max-rows", po::value<double>(), "replay mode rows/sec limit (default unlimited)")
             ("log-level", po::value<std::string>(), "set logging level [trace|debug|info|warning|error]")
+            ("recompute", "recompute kpi for the history range, print results and exit")
+            ("recompute-from", po::value<time_t>(), "recompute range begin (unixtime, default data begin)")
+            ("recompute-to", po::value<time_t>(), "recompute range end (unixtime, default data end)")
+            ("recompute-source", po::value<std::string>(), "recompute data source [memory|db] (default memory)")
+            ("recompute-run", po::value<unsigned>(), "recompute simulation run id (database source, default 0)")
+            ("worker-threads", po::value(&app.options.worker_threads), "worker pool size (default 4, 0 - hardware concurrency)")
+            ("max-runs", po::value(&app.options.max_runs), "max concurrent simulation runs (default 8)")
+            ("ws-compression-threshold", po::value(&WebsocketDataBus::instance().compression.threshold), "websocket messages below size are not compressed (default 512)")
+            ("ws-compression-level", po::value(&WebsocketDataBus::instance().compression.level), "websocket permessage-deflate level [0-9] (default 6)")
+            ("no-ws-compression", "disable websocket permessage-deflate")
+            ("shutdown-timeout", po::value<unsigned>(), "max seconds to drain in-flight work on shutdown (default 10)")
             ;
 
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, options), vm);
     po::notify(vm);
 
+    if (vm.count("no-ws-compression"))
+        WebsocketDataBus::instance().compression.enabled = false;
+
+    if (WebsocketDataBus::instance().compression.enabled && !WebsocketSession::compression_threshold_supported) {
+        Log("main", warning) << "websocket compression threshold not supported by this Boost.Beast version - "
+                                "messages of all sizes are compressed";
+    }
+
+    if (vm.count("shutdown-timeout"))
+        app.options.shutdown_timeout = std::chrono::seconds(vm["shutdown-timeout"].as<unsigned>());
+
     if (vm.count("help")) {
         std::cout << options << "\n";
         exit(EXIT_SUCCESS);
@@ -44,18 +75,83 @@ int main(int argc, const char* argv[]) try
     // Application init
     app.init();
 
+    // Stored kpi results
+    try {
+        app.loadKpiResults();
+    }
+    catch (std::exception& e) {
+        Log("main", error) << "load kpi results failed : " << e.what();
+    }
+
+    // Recompute mode
+    if (vm.count("recompute")) {
+        auto range = app.dataTimeRange();
+        if (vm.count("recompute-from"))
+            range.first = ClockType::from_time_t(vm["recompute-from"].as<time_t>());
+        if (vm.count("recompute-to"))
+            range.second = ClockType::from_time_t(vm["recompute-to"].as<time_t>());
+        auto source = KpiRecompute::sourceFromString(
+                vm.count("recompute-source") ? vm["recompute-source"].as<std::string>() : "memory");
+
+        std::mutex mtx;
+        std::vector<KpiRecompute::Result> results;
+        unsigned run_id = vm.count("recompute-run") ? vm["recompute-run"].as<unsigned>() : 0;
+        app.recompute(run_id, range.first, range.second, source, [&](auto const& res) {
+            std::lock_guard lock(mtx);
+            results.push_back(res);
+        });
+
+        std::sort(results.begin(), results.end(), [](auto const& a, auto const& b) {
+            return std::tie(a.time, a.weekly) < std::tie(b.time, b.weekly);
+        });
+
+        for (auto const& res : results) {
+            std::cout << (res.weekly ? "weekly" : "daily") << " "
+                      << TimeReference::timeStamp(res.time) << " " << res.value << "\n";
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    // Default simulation run settings
+    auto& timeref = app.defaultRun().timeReference();
+
     // Simulator initial speed
     if (vm.count("simspeed"))
-        TimeReference::instance().setSpeed(vm["simspeed"].as<unsigned>());
+        timeref.setSpeed(vm["simspeed"].as<unsigned>());
     else
-        TimeReference::instance().setSpeed(3600 * 24);
+        timeref.setSpeed(3600 * 24);
+
+    // Simulator tick period
+    if (vm.count("tick-period"))
+        timeref.setTickPeriod(std::chrono::milliseconds(vm["tick-period"].as<unsigned>()));
+
+    // Simulator mode
+    if (vm.count("replay-max-rows"))
+        timeref.setReplayRowsLimit(vm["replay-max-rows"].as<double>());
+    if (vm.count("speed-governor"))
+        app.defaultRun().speedGovernor().enable(true);
+    if (vm.count("overrun-policy"))
+        timeref.setOverrunPolicy(TimeReference::overrunPolicyFromString(vm["overrun-policy"].as<std::string>()));
+    if (vm.count("simmode"))
+        timeref.setMode(TimeReference::modeFromString(vm["simmode"].as<std::string>()));
 
     // Clear database
     app.cleanDatabase();
 
     // Start webserver
     unsigned short port = vm.count("httpport") ? vm["httpport"].as<unsigned short>() : 8080;
-    return Webserver().run(port);
+
+    // Runs are drained on SIGINT / SIGTERM before the webserver tears down its sessions
+    int rc = Webserver().run(port, [&] {
+        if (!app.shutdown()) {
+            // tasks still use the runs and sessions - exit without destroying them
+            Log("main", error) << "in-flight work not finished, exiting";
+            std::quick_exit(EXIT_FAILURE);
+        }
+    });
+
+    return rc;
 }
 catch (std::exception& e) {
     Log("main", error) << e.what();
@@ -0,0 +1,84 @@
+#include "test.h"
+#include "EnergyDelta.h"
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+
+bool near(double a, double b)
+{
+    return std::abs(a - b) <= 1e-9 * std::max(1.0, std::abs(b));
+}
+
+} // namespace
+
+TEST_CASE("energyDeltaSum equals scalar kernel on random input")
+{
+    std::mt19937 gen(27);
+    std::uniform_real_distribution<double> step(0, 50);
+    std::bernoulli_distribution reset(0.05);
+
+    // avx2 kernel where the cpu supports it (scalar against itself otherwise),
+    // all lengths around the 4 lane blocks, counter resets included
+    for (size_t n = 0; n < 70; ++n) {
+        for (int round = 0; round < 20; ++round) {
+            std::vector<double> val(n);
+            double v = 1000;
+            for (auto& x : val) {
+                v = reset(gen) ? step(gen) : v + step(gen);
+                x = v;
+            }
+            CHECK(near(energyDeltaSum(val.data(), n), energyDeltaSumScalar(val.data(), n)));
+        }
+    }
+
+    std::vector<double> big(100000);
+    double v = 0;
+    for (auto& x : big)
+        x = v = reset(gen) ? step(gen) : v + step(gen);
+    CHECK(near(energyDeltaSum(big.data(), big.size()), energyDeltaSumScalar(big.data(), big.size())));
+}
+
+TEST_CASE("energyDeltaSum counts reset as the new value")
+{
+    double val[] = {10, 15, 3, 8, 8, 2};
+    // 5 + 3 (reset) + 5 + 0 + 2 (reset)
+    CHECK_EQ(energyDeltaSum(val, 6), 15.0);
+    CHECK_EQ(energyDeltaSumScalar(val, 6), 15.0);
+}
+
+TEST_CASE("energyIntegrate with 0 and 1 points is zero")
+{
+    time_t t[] = {100};
+    double val[] = {5};
+    CHECK_EQ(energyIntegrate(t, val, 0, 0, 200), 0.0);
+    CHECK_EQ(energyIntegrate(t, val, 1, 0, 200), 0.0);
+}
+
+TEST_CASE("energyIntegrate with 2 points interpolates one interval")
+{
+    time_t t[] = {0, 100};
+    double val[] = {0, 100};
+    // inside the window - whole interval
+    CHECK_EQ(energyIntegrate(t, val, 2, 0, 100), 100.0);
+    // interval starts before the window
+    CHECK_EQ(energyIntegrate(t, val, 2, 40, 100), 60.0);
+    // single interval is only corrected at its start
+    CHECK_EQ(energyIntegrate(t, val, 2, 40, 60), 60.0);
+    // counter reset - no interpolation
+    double reset[] = {80, 30};
+    CHECK_EQ(energyIntegrate(t, reset, 2, 40, 100), 30.0);
+}
+
+TEST_CASE("energyIntegrate with 3 points interpolates both boundary intervals")
+{
+    time_t t[] = {0, 100, 200};
+    double val[] = {0, 100, 300};
+    CHECK_EQ(energyIntegrate(t, val, 3, 0, 200), 300.0);
+    // 50 of the first interval, 100 of the second
+    CHECK_EQ(energyIntegrate(t, val, 3, 50, 150), 150.0);
+    // reset in the last interval is taken whole
+    double reset[] = {0, 100, 40};
+    CHECK_EQ(energyIntegrate(t, reset, 3, 50, 150), 90.0);
+}
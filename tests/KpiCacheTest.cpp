@@ -0,0 +1,112 @@
+#include "test.h"
+#include "KpiCache.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// window (from, to] on hour boundaries, data available well before and after it
+struct CacheFixture
+{
+    TimePoint from {ClockType::from_time_t(1600000000 / 3600 * 3600)};
+    TimePoint to {from + 24h};
+    KpiCache cache;
+    int calculations {0};
+
+    CacheFixture()
+    {
+        cache.touch(from - 48h, to + 3h);
+    }
+
+    double get()
+    {
+        return cache.get(from, to, [this] {
+            return static_cast<double>(++calculations);
+        });
+    }
+};
+
+} // namespace
+
+TEST_CASE("KpiCache hits while window data is unchanged")
+{
+    CacheFixture f;
+    CHECK_EQ(f.get(), 1.0);
+    CHECK_EQ(f.get(), 1.0);
+    CHECK_EQ(f.calculations, 1);
+    CHECK_EQ(f.cache.statistics().hits, 1ul);
+}
+
+TEST_CASE("KpiCache invalidates on touch inside the window")
+{
+    CacheFixture f;
+    f.get();
+    f.cache.touch(f.from + 12h, f.from + 12h);
+    CHECK_EQ(f.get(), 2.0);
+}
+
+TEST_CASE("KpiCache invalidates on touch within one hour of the window")
+{
+    CacheFixture f;
+    f.get();
+    f.cache.touch(f.to + 30min, f.to + 30min);
+    CHECK_EQ(f.get(), 2.0);
+    f.cache.touch(f.from - 30min, f.from - 30min);
+    CHECK_EQ(f.get(), 3.0);
+}
+
+TEST_CASE("KpiCache keeps value on touch more than one hour away")
+{
+    CacheFixture f;
+    f.get();
+    f.cache.touch(f.to + 2h + 30min, f.to + 2h + 30min);
+    f.cache.touch(f.from - 90min, f.from - 90min);
+    CHECK_EQ(f.get(), 1.0);
+}
+
+TEST_CASE("KpiCache invalidates values calculated before data after the window")
+{
+    KpiCache cache;
+    auto from = ClockType::from_time_t(1600000000 / 3600 * 3600);
+    auto to = from + 24h;
+    int calculations = 0;
+    auto calc = [&] { return static_cast<double>(++calculations); };
+
+    cache.touch(from, to);
+    cache.get(from, to, calc);
+    cache.touch(to + 5h, to + 5h);
+    CHECK_EQ(cache.get(from, to, calc), 2.0);
+    cache.touch(to + 10h, to + 10h);
+    CHECK_EQ(cache.get(from, to, calc), 2.0);
+}
+
+TEST_CASE("KpiCache drops versions older than the oldest cached window")
+{
+    KpiCache cache;
+    auto t0 = ClockType::from_time_t(1600000000 / 3600 * 3600);
+    auto calc = [] { return 1.0; };
+
+    // a year of daily windows, one insert per hour
+    for (int day = 0; day < 365; ++day) {
+        auto to = t0 + day * 24h;
+        cache.touch(to - 24h, to + 24h);
+        cache.get(to - 24h, to, calc);
+    }
+    auto stat = cache.statistics();
+    CHECK_EQ(stat.entries, 365ul);
+
+    // more windows than the cache keeps
+    for (size_t i = 0; i < KpiCache::max_entries; ++i)
+        cache.get(t0 + 365 * 24h + i * 1h, t0 + 366 * 24h + i * 1h, calc);
+    stat = cache.statistics();
+    CHECK_EQ(stat.entries, KpiCache::max_entries);
+    CHECK(stat.buckets < 100);
+
+    // window below the dropped versions still sees a newer insert
+    int calculations = 0;
+    auto counted = [&] { return static_cast<double>(++calculations); };
+    cache.get(t0, t0 + 24h, counted);
+    cache.touch(t0 + 12h, t0 + 12h);
+    cache.get(t0, t0 + 24h, counted);
+    CHECK_EQ(calculations, 2);
+}
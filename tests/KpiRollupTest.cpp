@@ -0,0 +1,101 @@
+#include "test.h"
+#include "Daq.h"
+#include "KpiRollup.h"
+#include <ctime>
+
+namespace {
+
+TimePoint utc(int year, int month, int day, int hour, int min = 0, int sec = 0)
+{
+    std::tm tm = {};
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = min;
+    tm.tm_sec = sec;
+    return ClockType::from_time_t(timegm(&tm));
+}
+
+// production of the period ending at end (0 if the period is not returned)
+double production(std::vector<KpiRollup::Entry> const& entries, TimePoint end)
+{
+    for (auto const& e : entries) {
+        if (e.time == end)
+            return e.sum.production;
+    }
+    return 0;
+}
+
+} // namespace
+
+TEST_CASE("KpiRollup hour bucket includes its end")
+{
+    KpiRollup rollup;
+    rollup.insert(DaqType::production, utc(2021, 3, 10, 7), 1);
+    rollup.insert(DaqType::production, utc(2021, 3, 10, 7, 0, 1), 10);
+
+    auto hours = rollup.query(KpiRollup::Granularity::hour, utc(2021, 3, 10, 6), utc(2021, 3, 10, 8));
+    CHECK_EQ(hours.size(), 2ul);
+    CHECK_EQ(production(hours, utc(2021, 3, 10, 7)), 1.0);
+    CHECK_EQ(production(hours, utc(2021, 3, 10, 8)), 10.0);
+}
+
+TEST_CASE("KpiRollup splits energy over hour boundary")
+{
+    KpiRollup rollup;
+    rollup.insert(DaqType::energy, utc(2021, 3, 10, 6, 30), 100);
+    rollup.insert(DaqType::energy, utc(2021, 3, 10, 7, 30), 200);
+
+    auto hours = rollup.query(KpiRollup::Granularity::hour, utc(2021, 3, 10, 6), utc(2021, 3, 10, 8));
+    CHECK_EQ(hours.size(), 2ul);
+    CHECK_EQ(hours[0].sum.energy, 50.0);
+    CHECK_EQ(hours[1].sum.energy, 50.0);
+}
+
+TEST_CASE("KpiRollup day starts at 06:00 UTC")
+{
+    KpiRollup rollup;
+    rollup.insert(DaqType::production, utc(2021, 3, 10, 6), 1);
+    rollup.insert(DaqType::production, utc(2021, 3, 10, 6, 0, 1), 10);
+    rollup.insert(DaqType::production, utc(2021, 3, 11, 5, 59), 100);
+
+    auto days = rollup.query(KpiRollup::Granularity::day, utc(2021, 3, 9, 6), utc(2021, 3, 11, 6));
+    CHECK_EQ(days.size(), 2ul);
+    CHECK_EQ(production(days, utc(2021, 3, 10, 6)), 1.0);
+    CHECK_EQ(production(days, utc(2021, 3, 11, 6)), 110.0);
+}
+
+TEST_CASE("KpiRollup week ends on sunday 06:00 UTC")
+{
+    KpiRollup rollup;
+    // 2021-03-14 is a sunday
+    rollup.insert(DaqType::production, utc(2021, 3, 7, 7), 1);
+    rollup.insert(DaqType::production, utc(2021, 3, 14, 5), 10);
+    rollup.insert(DaqType::production, utc(2021, 3, 14, 7), 100);
+
+    auto weeks = rollup.query(KpiRollup::Granularity::week, utc(2021, 3, 1, 0), utc(2021, 3, 22, 0));
+    CHECK_EQ(weeks.size(), 3ul);
+    CHECK_EQ(production(weeks, utc(2021, 3, 7, 6)), 0.0);
+    CHECK_EQ(production(weeks, utc(2021, 3, 14, 6)), 11.0);
+    CHECK_EQ(production(weeks, utc(2021, 3, 21, 6)), 100.0);
+}
+
+TEST_CASE("KpiRollup month holds kpi days starting in it")
+{
+    KpiRollup rollup;
+    // day of 2021-01-31 06:00 - 2021-02-01 06:00 belongs to january,
+    // day of 2021-02-28 06:00 - 2021-03-01 06:00 to february
+    rollup.insert(DaqType::production, utc(2021, 1, 1, 7), 1);
+    rollup.insert(DaqType::production, utc(2021, 2, 1, 5), 10);
+    rollup.insert(DaqType::production, utc(2021, 2, 1, 7), 100);
+    rollup.insert(DaqType::production, utc(2021, 3, 1, 6), 1000);
+
+    auto months = rollup.query(KpiRollup::Granularity::month, utc(2021, 1, 1, 0), utc(2021, 3, 2, 0));
+    // december 2020 ends within the range as well
+    CHECK_EQ(months.size(), 3ul);
+    CHECK(months[0].time == utc(2021, 1, 1, 6));
+    CHECK_EQ(months[0].sum.production, 0.0);
+    CHECK_EQ(production(months, utc(2021, 2, 1, 6)), 11.0);
+    CHECK_EQ(production(months, utc(2021, 3, 1, 6)), 1100.0);
+}
@@ -0,0 +1,83 @@
+#include "test.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <latch>
+#include <mutex>
+#include <vector>
+
+TEST_CASE("Strand runs tasks in posting order")
+{
+    ThreadPool pool(4, "TestPool");
+    Strand strand(pool);
+
+    constexpr int n = 1000;
+    std::vector<int> order;
+    std::latch done(n);
+
+    for (int i = 0; i < n; ++i) {
+        strand.post([&, i] {
+            order.push_back(i); // serialized by the strand
+            done.count_down();
+        });
+    }
+    done.wait();
+
+    CHECK_EQ(order.size(), static_cast<size_t>(n));
+    for (int i = 0; i < n; ++i)
+        CHECK_EQ(order[i], i);
+}
+
+TEST_CASE("Strand gives the worker to another strand after a batch")
+{
+    ThreadPool pool(1, "TestPool");
+    Strand a(pool);
+    Strand b(pool);
+
+    // hold the only worker until both strands have queued their tasks
+    std::latch queued(1);
+    pool.submit([&] { queued.wait(); });
+
+    constexpr int n = 5 * Strand::max_batch;
+    std::vector<char> trace;
+    std::mutex mtx;
+    std::latch done(2 * n);
+
+    for (int i = 0; i < n; ++i) {
+        for (auto* s : { &a, &b }) {
+            char id = s == &a ? 'a' : 'b';
+            s->post([&, id] {
+                std::lock_guard lock(mtx);
+                trace.push_back(id);
+                done.count_down();
+            });
+        }
+    }
+    queued.count_down();
+    done.wait();
+
+    // while both strands have work, a run of one strand is not longer than a batch
+    auto last_a = std::find(trace.rbegin(), trace.rend(), 'a').base();
+    auto last_b = std::find(trace.rbegin(), trace.rend(), 'b').base();
+    auto end = std::min(last_a, last_b);
+
+    size_t run = 0;
+    size_t max_run = 0;
+    for (auto it = trace.begin(); it != end; ++it) {
+        run = it != trace.begin() && *it == *(it - 1) ? run + 1 : 1;
+        max_run = std::max(max_run, run);
+    }
+    CHECK(max_run <= Strand::max_batch);
+}
+
+TEST_CASE("Strand post after pool stop does not hang the destructor")
+{
+    ThreadPool pool(1, "TestPool");
+    pool.stop();
+
+    bool ran = false;
+    {
+        Strand strand(pool);
+        strand.post([&] { ran = true; });
+    }
+    CHECK(!ran);
+}
@@ -0,0 +1,120 @@
+#include "test.h"
+#include "TimerWheel.h"
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+time_t utc(int year, int month, int day, int hour = 0)
+{
+    std::tm tm = {};
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    return timegm(&tm);
+}
+
+// Events are scheduled in UTC, local time zone with daylight saving must not move them
+struct LocalTimeZone
+{
+    explicit LocalTimeZone(char const* tz)
+    {
+        if (char const* prev = getenv("TZ"))
+            prev_ = prev;
+        setenv("TZ", tz, 1);
+        tzset();
+    }
+
+    ~LocalTimeZone()
+    {
+        if (prev_.empty())
+            unsetenv("TZ");
+        else
+            setenv("TZ", prev_.c_str(), 1);
+        tzset();
+    }
+
+    std::string prev_;
+};
+
+// Advances the wheel by hour ticks over [from, to]
+void runHourly(TimerWheel& wheel, TimePoint from, TimePoint to)
+{
+    for (auto tp = from; tp <= to; tp += 1h)
+        wheel.advance(tp);
+}
+
+} // namespace
+
+TEST_CASE("TimerWheel daily event keeps 06:00 UTC across daylight saving change")
+{
+    LocalTimeZone tz("Europe/Ljubljana");
+
+    // CET -> CEST on 2021-03-28, CEST -> CET on 2021-10-31
+    for (auto day : { utc(2021, 3, 25), utc(2021, 10, 28) }) {
+        auto start = ClockType::from_time_t(day);
+        std::vector<time_t> fired;
+        TimerWheel wheel;
+        wheel.reset(start);
+        wheel.schedule(TimerWheel::timeOfDay(start, 6), [&](TimePoint due) {
+            fired.push_back(ClockType::to_time_t(due));
+        }, TimerWheel::every(24h));
+
+        runHourly(wheel, start, start + 7 * 24h);
+
+        CHECK_EQ(fired.size(), 7ul);
+        for (size_t i = 0; i < fired.size(); ++i)
+            CHECK_EQ(fired[i], day + 6 * 3600 + static_cast<time_t>(i) * 24 * 3600);
+    }
+}
+
+TEST_CASE("TimerWheel weekly event fires on sundays across daylight saving change")
+{
+    LocalTimeZone tz("Europe/Ljubljana");
+
+    auto start = ClockType::from_time_t(utc(2021, 3, 17));
+    std::vector<time_t> fired;
+    TimerWheel wheel;
+    wheel.reset(start);
+    wheel.schedule(TimerWheel::nextWeekday(start, 0, 6), [&](TimePoint due) {
+        fired.push_back(ClockType::to_time_t(due));
+    }, TimerWheel::every(7 * 24h));
+
+    runHourly(wheel, start, ClockType::from_time_t(utc(2021, 4, 12)));
+
+    std::vector<time_t> expected {utc(2021, 3, 21, 6), utc(2021, 3, 28, 6), utc(2021, 4, 4, 6), utc(2021, 4, 11, 6)};
+    CHECK(fired == expected);
+}
+
+TEST_CASE("TimerWheel monthly event fires on month starts across daylight saving change")
+{
+    LocalTimeZone tz("Europe/Ljubljana");
+
+    auto start = ClockType::from_time_t(utc(2021, 2, 15));
+    std::vector<time_t> fired;
+    TimerWheel wheel;
+    wheel.reset(start);
+    wheel.schedule(TimerWheel::nextMonth(start, 6), [&](TimePoint due) {
+        fired.push_back(ClockType::to_time_t(due));
+    }, TimerWheel::monthly());
+
+    // one long jump spans several occurrences
+    wheel.advance(ClockType::from_time_t(utc(2021, 11, 15)));
+
+    std::vector<time_t> expected;
+    for (int month = 3; month <= 11; ++month)
+        expected.push_back(utc(2021, month, 1, 6));
+    CHECK(fired == expected);
+}
+
+TEST_CASE("TimerWheel monthly recurrence clamps day to month length")
+{
+    auto next = TimerWheel::monthly();
+    CHECK_EQ(ClockType::to_time_t(next(ClockType::from_time_t(utc(2024, 1, 31, 6)))), utc(2024, 2, 29, 6));
+    CHECK_EQ(ClockType::to_time_t(next(ClockType::from_time_t(utc(2023, 12, 31, 6)))), utc(2024, 1, 31, 6));
+}
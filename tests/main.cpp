@@ -0,0 +1,33 @@
+#include "test.h"
+#include "Log.h"
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+// Runs all test cases, or the cases whose name starts with the first argument
+int main(int argc, char* argv[])
+{
+    Log::setGlobalLoggingLevel(warning);
+
+    std::string_view filter = argc > 1 ? argv[1] : "";
+    int failed = 0;
+    int passed = 0;
+
+    for (auto const& it : test::cases()) {
+        if (!it.name.starts_with(filter))
+            continue;
+
+        try {
+            it.func();
+            ++passed;
+            std::cout << "[ passed ] " << it.name << "\n";
+        }
+        catch (std::exception& e) {
+            ++failed;
+            std::cout << "[ FAILED ] " << it.name << " : " << e.what() << "\n";
+        }
+    }
+
+    std::cout << passed << " passed, " << failed << " failed\n";
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
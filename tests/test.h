@@ -0,0 +1,69 @@
+#ifndef ZELEZARNA_TEST_H
+#define ZELEZARNA_TEST_H
+
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Minimal test registry - TEST_CASE registers a function, CHECK throws on failure
+namespace test {
+
+struct Case
+{
+    std::string name;
+    std::function<void()> func;
+};
+
+inline std::vector<Case>& cases()
+{
+    static std::vector<Case> registry;
+    return registry;
+}
+
+struct Register
+{
+    Register(std::string name, std::function<void()> func)
+    {
+        cases().push_back({std::move(name), std::move(func)});
+    }
+};
+
+struct Failure : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+} // namespace test
+
+#define TEST_CONCAT_IMPL(a, b) a##b
+#define TEST_CONCAT(a, b) TEST_CONCAT_IMPL(a, b)
+
+#define TEST_CASE(name) \
+    static void TEST_CONCAT(test_func_, __LINE__)(); \
+    static test::Register TEST_CONCAT(test_reg_, __LINE__)(name, &TEST_CONCAT(test_func_, __LINE__)); \
+    static void TEST_CONCAT(test_func_, __LINE__)()
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            std::ostringstream test_os; \
+            test_os << __FILE__ << ":" << __LINE__ << " CHECK(" #expr ") failed"; \
+            throw test::Failure(test_os.str()); \
+        } \
+    } while (false)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        auto const& test_a = (a); \
+        auto const& test_b = (b); \
+        if (!(test_a == test_b)) { \
+            std::ostringstream test_os; \
+            test_os << __FILE__ << ":" << __LINE__ << " CHECK_EQ(" #a ", " #b ") failed : " \
+                    << test_a << " != " << test_b; \
+            throw test::Failure(test_os.str()); \
+        } \
+    } while (false)
+
+#endif //ZELEZARNA_TEST_H
@@ -94,6 +94,7 @@ class HttpSession : public Object, public std::enable_shared_from_this<HttpSessi
     beast::tcp_stream stream_;
     beast::flat_buffer buffer_;
     std::shared_ptr<std::string const> doc_root_;
+    size_t shard_;
     queue queue_;
 
     boost::optional<HttpHandleRequest> parser_;
@@ -102,10 +103,12 @@ public:
     // Take ownership of the socket
     HttpSession(
         tcp::socket&& socket,
-        std::shared_ptr<std::string const> doc_root)
+        std::shared_ptr<std::string const> doc_root,
+        size_t shard = 0)
         : Object("HttpSession")
         , stream_(std::move(socket))
         , doc_root_(std::move(doc_root))
+        , shard_(shard)
         , queue_(*this)
     {
     }
@@ -156,9 +159,11 @@ private:
             return;
         }
 
-        // Parse ip address
-        std::string ip_addr = stream_.socket().remote_endpoint().address().to_string();
-        if (parser_->get().find("X-Real-IP") != parser_->get().end()) {
+        // Parse ip address, X-Real-IP is trusted only from the local reverse proxy
+        // (a client connecting directly could claim a loopback address)
+        auto peer = stream_.socket().remote_endpoint().address();
+        std::string ip_addr = peer.to_string();
+        if (peer.is_loopback() && parser_->get().find("X-Real-IP") != parser_->get().end()) {
             ip_addr = parser_->get()["X-Real-IP"].to_string();
         }
 
@@ -167,7 +172,7 @@ private:
         {
             // Create a websocket session, transferring ownership
             // of both the socket and the HTTP request.
-            auto ws = std::make_shared<WebsocketSession>(std::move(stream_.release_socket()));
+            auto ws = std::make_shared<WebsocketSession>(std::move(stream_.release_socket()), shard_);
             ws->run(std::move(parser_->release()), ip_addr);
             return;
         }
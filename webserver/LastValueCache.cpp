@@ -0,0 +1,65 @@
+#include "LastValueCache.h"
+#include "WebsocketDataBus.h"
+#include "nlohmann/json.hpp"
+
+#include <algorithm>
+
+void LastValueCache::update(std::shared_ptr<nlohmann::json const> const& j, std::optional<Topic> topic, std::string const& key,
+                            bool admin_only)
+{
+    std::lock_guard lock(mtx_);
+
+    if (topic == Topic::kpi_daily || topic == Topic::kpi_weekly) {
+        kpi_.push_back({j, topic, admin_only});
+        if (kpi_.size() > max_kpi_)
+            kpi_.pop_front();
+    }
+    else if (topic == Topic::series_energy || topic == Topic::series_production) {
+        auto& tail = series_[*topic];
+        tail.push_back({j, topic, admin_only});
+        if (tail.size() > max_series_)
+            tail.pop_front();
+    }
+    else if (!key.empty()) {
+        // status, sim time, runs list and last requested statistics
+        latest_[key] = {j, topic, admin_only};
+    }
+}
+
+void LastValueCache::forgetRun(unsigned run_id)
+{
+    forgetResults(run_id);
+
+    std::lock_guard lock(mtx_);
+    std::erase_if(latest_, [run_id](auto const& it) {
+        return it.second.json->value("run_id", 0u) == run_id;
+    });
+}
+
+void LastValueCache::forgetResults(unsigned run_id)
+{
+    auto of_run = [run_id](Entry const& e) {
+        return e.json->value("run_id", 0u) == run_id;
+    };
+
+    std::lock_guard lock(mtx_);
+
+    std::erase_if(kpi_, of_run);
+    for (auto& it : series_)
+        std::erase_if(it.second, of_run);
+}
+
+std::vector<LastValueCache::Entry> LastValueCache::snapshot() const
+{
+    std::vector<Entry> result;
+
+    std::lock_guard lock(mtx_);
+
+    for (auto const& it : latest_)
+        result.push_back(it.second);
+    result.insert(result.end(), kpi_.begin(), kpi_.end());
+    for (auto const& it : series_)
+        result.insert(result.end(), it.second.begin(), it.second.end());
+
+    return result;
+}
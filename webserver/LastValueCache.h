@@ -0,0 +1,61 @@
+#ifndef LASTVALUECACHE_H
+#define LASTVALUECACHE_H
+
+#include "Object.h"
+#include "nlohmann/json_fwd.hpp"
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+enum class Topic : unsigned;
+
+//
+// Last published values for late joining webclients: latest status, sim time, runs list and
+// operation statistics, last kpi results and the tail of raw series messages (series are only
+// published while a session is subscribed to them). Admin only messages are kept with their
+// flag and replayed to admin sessions only.
+//
+class LastValueCache : public Object
+{
+public:
+    struct Entry
+    {
+        std::shared_ptr<nlohmann::json const> json;
+        std::optional<Topic> topic;
+        bool admin_only {false};
+    };
+
+    explicit LastValueCache(size_t max_kpi = 64, size_t max_series = 16)
+        : Object("LastValueCache")
+        , max_kpi_(max_kpi)
+        , max_series_(max_series)
+    {}
+
+    // Published message with its topic and coalesce key
+    void update(std::shared_ptr<nlohmann::json const> const& j, std::optional<Topic> topic, std::string const& key,
+                bool admin_only);
+
+    // Removes values of a closed simulation run
+    void forgetRun(unsigned run_id);
+
+    // Removes kpi and series of a restarted simulation run (latest values stay)
+    void forgetResults(unsigned run_id);
+
+    // Cached messages in publish order by kind: latest values, kpi, series
+    std::vector<Entry> snapshot() const;
+
+private:
+    size_t max_kpi_;
+    size_t max_series_;
+
+    std::map<std::string, Entry> latest_;   // by coalesce key
+    std::deque<Entry> kpi_;
+    std::map<Topic, std::deque<Entry>> series_;
+    std::mutex mutable mtx_;
+};
+
+#endif // LASTVALUECACHE_H
@@ -0,0 +1,103 @@
+#ifndef METEREDSTREAM_H
+#define METEREDSTREAM_H
+
+#include "Webserver_common.h"
+#include <ctime>
+
+//
+// Websocket next layer counting bytes written to the socket and thread cpu time
+// the websocket stream spends preparing frames (permessage-deflate compression).
+// Frames are prepared synchronously in the write initiation and in the completion
+// of the previous socket write - cpu is measured only inside these windows.
+//
+class MeteredStream
+{
+public:
+    using executor_type = beast::tcp_stream::executor_type;
+    using next_layer_type = beast::tcp_stream;
+
+    struct Counters
+    {
+        size_t bytes {0};
+        double cpu_ms {0};
+    };
+
+    explicit MeteredStream(tcp::socket&& socket)
+        : stream_(std::move(socket))
+    {}
+
+    executor_type get_executor() noexcept { return stream_.get_executor(); }
+
+    next_layer_type& next_layer() noexcept { return stream_; }
+
+    next_layer_type const& next_layer() const noexcept { return stream_; }
+
+    // Call around websocket async_write initiation
+    void startCpuMeter() { cpu_mark_ = threadCpuTime(); metering_ = true; }
+
+    void stopCpuMeter() { metering_ = false; }
+
+    // Counters since the previous call
+    Counters take()
+    {
+        Counters c = counters_;
+        counters_ = {};
+        return c;
+    }
+
+    template<class MutableBufferSequence, class ReadHandler>
+    auto async_read_some(MutableBufferSequence const& buffers, ReadHandler&& handler)
+    {
+        return stream_.async_read_some(buffers, std::forward<ReadHandler>(handler));
+    }
+
+    template<class ConstBufferSequence, class WriteHandler>
+    auto async_write_some(ConstBufferSequence const& buffers, WriteHandler&& handler)
+    {
+        if (metering_) {
+            counters_.cpu_ms += (threadCpuTime() - cpu_mark_) * 1e-6;
+            metering_ = false;
+        }
+
+        auto ex = net::get_associated_executor(handler, get_executor());
+        return stream_.async_write_some(buffers, net::bind_executor(ex,
+            [this, h = std::decay_t<WriteHandler>(std::forward<WriteHandler>(handler))]
+            (beast::error_code ec, std::size_t n) mutable {
+                counters_.bytes += n;
+
+                // next frame is prepared inside the handler
+                startCpuMeter();
+                h(ec, n);
+                stopCpuMeter();
+            }));
+    }
+
+    friend void teardown(beast::role_type role, MeteredStream& s, beast::error_code& ec)
+    {
+        using beast::websocket::teardown;
+        teardown(role, s.stream_, ec);
+    }
+
+    template<class TeardownHandler>
+    friend void async_teardown(beast::role_type role, MeteredStream& s, TeardownHandler&& handler)
+    {
+        using beast::websocket::async_teardown;
+        async_teardown(role, s.stream_, std::forward<TeardownHandler>(handler));
+    }
+
+private:
+    // nanoseconds
+    static long long threadCpuTime()
+    {
+        timespec ts {};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    beast::tcp_stream stream_;
+    Counters counters_;
+    long long cpu_mark_ {0};
+    bool metering_ {false};
+};
+
+#endif // METEREDSTREAM_H
@@ -1,28 +1,33 @@
 #include "Webserver.h"
 #include "Webserver_common.h"
 #include "HttpSession.h"
+#include "WebsocketDataBus.h"
 #include <boost/asio/signal_set.hpp>
 #include <boost/asio/strand.hpp>
 #include <thread>
 #include <vector>
 
 
+using ShardExecutor = net::strand<net::io_context::executor_type>;
+
 // Accepts incoming connections and launches the sessions
 class Listener : public Object, public std::enable_shared_from_this<Listener>
 {
-    net::io_context& ioc_;
     tcp::acceptor acceptor_;
     std::shared_ptr<std::string const> doc_root_;
+    std::vector<ShardExecutor> shards_;
+    size_t next_shard_ {0};
 
 public:
     Listener(
         net::io_context& ioc,
+        std::vector<ShardExecutor> shards,
         tcp::endpoint endpoint,
         std::shared_ptr<std::string const> doc_root)
         : Object("Listener")
-        , ioc_(ioc)
         , acceptor_(net::make_strand(ioc))
         , doc_root_(std::move(doc_root))
+        , shards_(std::move(shards))
     {
         beast::error_code ec;
 
@@ -68,15 +73,18 @@ public:
 private:
     void do_accept()
     {
-        // The new connection gets its own strand
+        // Connections are assigned to broadcast shards round robin, the connection runs on the shard strand
+        // (commands waiting for ticks are passed to the application control pool)
+        size_t shard = next_shard_++ % shards_.size();
         acceptor_.async_accept(
-            net::make_strand(ioc_),
+            shards_[shard],
             beast::bind_front_handler(
                 &Listener::on_accept,
-                shared_from_this()));
+                shared_from_this(),
+                shard));
     }
 
-    void on_accept(beast::error_code ec, tcp::socket socket)
+    void on_accept(size_t shard, beast::error_code ec, tcp::socket socket)
     {
         if(ec)
         {
@@ -87,7 +95,8 @@ private:
             // Create the http session and run it
             std::make_shared<HttpSession>(
                 std::move(socket),
-                doc_root_)->run();
+                doc_root_,
+                shard)->run();
         }
 
         // Accept another connection
@@ -95,7 +104,7 @@ private:
     }
 };
 
-int Webserver::run(unsigned short port) {
+int Webserver::run(unsigned short port, std::function<void()> const& before_stop) {
 
     auto const address = boost::asio::ip::make_address("0.0.0.0");
     log(info) << "Starting webserver port " << port;
@@ -113,9 +122,21 @@ int Webserver::run(unsigned short port) {
     load_server_certificate(ctx);
 #   endif
 
+    // Broadcast shards, one strand per io thread
+    std::vector<ShardExecutor> shards;
+    std::vector<WebsocketDataBus::Dispatcher> dispatchers;
+    for (int i = 0; i < threads; ++i) {
+        auto& shard = shards.emplace_back(net::make_strand(ioc));
+        dispatchers.emplace_back([shard](std::function<void()>&& task) {
+            net::post(shard, std::move(task));
+        });
+    }
+    WebsocketDataBus::instance().setShards(std::move(dispatchers));
+
     // Create and launch a listening port
     std::make_shared<Listener>(
         ioc,
+        std::move(shards),
 #       ifdef HTTP_SERVER_ASYNC_FLEX
         ctx,
 #       endif
@@ -127,6 +148,11 @@ int Webserver::run(unsigned short port) {
     signals.async_wait(
         [&](boost::system::error_code const&, int)
         {
+            // Work still using sessions and strands (simulation ticks) must finish
+            // while the other io threads keep serving them
+            if (before_stop)
+                before_stop();
+
             // Stop the `io_context`. This will cause `run()`
             // to return immediately, eventually destroying the
             // `io_context` and all of the sockets in it.
@@ -146,6 +172,9 @@ int Webserver::run(unsigned short port) {
     for(auto& t : v)
         t.join();
 
+    // Sessions must be released while the io_context exists
+    WebsocketDataBus::instance().unregisterAll();
+
     log(info) << "webserver finished";
 
     return EXIT_SUCCESS;
@@ -2,6 +2,7 @@
 #define WEBSERVER_H
 
 #include "Object.h"
+#include <functional>
 
 class Webserver : public Object
 {
@@ -11,7 +12,8 @@ public:
         : Object("Webserver")
     {}
 
-    int run(unsigned short port);
+    // Serves until SIGINT / SIGTERM, before_stop is called while the io_context still runs
+    int run(unsigned short port, std::function<void()> const& before_stop = {});
 };
 
 #endif
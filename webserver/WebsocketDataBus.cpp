@@ -2,6 +2,8 @@
 #include "WebsocketSession.h"
 #include "nlohmann/json.hpp"
 
+#include <algorithm>
+#include <iterator>
 #include <mutex>
 
 //
@@ -13,11 +15,40 @@ WebsocketDataBus& WebsocketDataBus::instance()
     return bus;
 }
 
-void WebsocketDataBus::registerSession(WebsocketSession* cli)
+void WebsocketDataBus::setShards(std::vector<Dispatcher>&& dispatchers)
 {
-    log(debug) << "Registering new websocket session " << cli;
-    std::unique_lock lock(mtx);
-    sessions_.insert(cli);
+    std::lock_guard lock(mtx);
+
+    auto shards = std::make_shared<shard_list>();
+    for (auto& dispatch : dispatchers)
+        shards->push_back(std::make_shared<Shard>(std::move(dispatch)));
+    if (shards->empty())
+        shards->push_back(std::make_shared<Shard>());
+
+    // move sessions registered so far
+    std::vector<session_list> sessions(shards->size());
+    for (auto const& shard : *shards_.load()) {
+        for (auto const& cli : *shard->sessions.load())
+            sessions[cli->shard() % shards->size()].push_back(cli);
+    }
+    for (size_t i = 0; i < shards->size(); ++i)
+        (*shards)[i]->sessions.store(std::make_shared<session_list const>(std::move(sessions[i])));
+
+    shards_.store(std::move(shards));
+    log(debug) << "broadcast shards " << dispatchers.size();
+}
+
+void WebsocketDataBus::registerSession(std::shared_ptr<WebsocketSession> cli)
+{
+    log(debug) << "Registering new websocket session " << cli.get();
+    std::lock_guard lock(mtx);
+
+    auto shards = shards_.load();
+    auto& shard = *(*shards)[cli->shard() % shards->size()];
+
+    auto sessions = std::make_shared<session_list>(*shard.sessions.load());
+    sessions->push_back(std::move(cli));
+    shard.sessions.store(std::move(sessions));
 }
 
 void WebsocketDataBus::unregisterSession(WebsocketSession* cli)
@@ -25,12 +56,22 @@ void WebsocketDataBus::unregisterSession(WebsocketSession* cli)
     std::unique_lock lock(mtx);
 
     bool removed = [&]() -> bool {
-        auto it = std::find(sessions_.begin(), sessions_.end(), cli);
-        if (it != sessions_.end()) {
-            sessions_.erase(it);
-            return true;
-        }
-        return false;
+        auto shards = shards_.load();
+        auto& shard = *(*shards)[cli->shard() % shards->size()];
+
+        auto current = shard.sessions.load();
+        auto it = std::find_if(current->begin(), current->end(), [cli](auto const& sp) {
+            return sp.get() == cli;
+        });
+        if (it == current->end())
+            return false;
+
+        auto sessions = std::make_shared<session_list>();
+        sessions->reserve(current->size() - 1);
+        std::copy(current->begin(), it, std::back_inserter(*sessions));
+        std::copy(std::next(it), current->end(), std::back_inserter(*sessions));
+        shard.sessions.store(std::move(sessions));
+        return true;
     }();
 
     lock.unlock();
@@ -43,33 +84,255 @@ void WebsocketDataBus::unregisterSession(WebsocketSession* cli)
     }
 }
 
+void WebsocketDataBus::unregisterAll()
+{
+    std::lock_guard lock(mtx);
+
+    // dispatchers post to the io_context being destroyed as well
+    auto shards = std::make_shared<shard_list>();
+    shards->push_back(std::make_shared<Shard>());
+    shards_.store(std::move(shards));
+}
+
+namespace {
+
+constexpr std::string_view topic_names[] = {
+    "sim_time",
+    "kpi_daily",
+    "kpi_weekly",
+    "operation_statistics",
+    "series_energy",
+    "series_production"
+};
+
+} // namespace
+
 void WebsocketDataBus::messageToWebclients(nlohmann::json&& j, bool admin_only)
 {
-    messageToWebclients(j.dump(), admin_only);
+    auto topic = topicOf(j);
+    auto key = coalesceKey(j);
+    auto json = std::make_shared<nlohmann::json const>(std::move(j));
+    cache_.update(json, topic, key, admin_only);
+
+    auto shards = shards_.load();
+
+    // encodings used by the receiving sessions
+    unsigned encodings = 0;
+    for (auto const& shard : *shards) {
+        for (auto const& cli : *shard->sessions.load()) {
+            if (accepts(*cli, admin_only, topic))
+                encodings |= 1u << static_cast<unsigned>(cli->encoding());
+        }
+    }
+
+    if (encodings == 0)
+        return;
+
+    // serialized once per encoding, shared by all shards
+    auto b = std::make_shared<Broadcast>();
+    for (unsigned i = 0; i < encoding_count; ++i) {
+        if (encodings & (1u << i))
+            b->encoded[i] = std::make_shared<std::string const>(encode(*json, static_cast<Encoding>(i)));
+    }
+    b->key = std::move(key);
+    b->admin_only = admin_only;
+    b->topic = topic;
+    b->json = std::move(json);
+
+    publish(*shards, std::move(b));
+}
+
+void WebsocketDataBus::messageToWebclients(std::string&& msg, bool admin_only, std::string const& coalesce_key,
+                                           std::optional<Topic> topic)
+{
+    auto b = std::make_shared<Broadcast>();
+    b->encoded[static_cast<unsigned>(Encoding::json)] = std::make_shared<std::string const>(std::move(msg));
+    b->key = coalesce_key;
+    b->admin_only = admin_only;
+    b->topic = topic;
+
+    publish(*shards_.load(), std::move(b));
+}
+
+void WebsocketDataBus::sendLastValues(WebsocketSession& cli, unsigned topic_mask)
+{
+    auto encoding = cli.encoding();
+    size_t n = 0;
+
+    for (auto const& e : cache_.snapshot()) {
+        if (e.topic ? !(topic_mask & topicBit(*e.topic)) || !cli.isSubscribed(*e.topic) : topic_mask != ~0u)
+            continue;
+        if (e.admin_only && !cli.isAdmin())
+            continue;
+
+        cli.sendInStrand(std::make_shared<std::string const>(encode(*e.json, encoding)), coalesceKey(*e.json),
+                         encoding != Encoding::json);
+        ++n;
+    }
+
+    log(debug) << "session " << &cli << " - " << n << " cached messages sent";
+}
+
+std::string WebsocketDataBus::coalesceKey(nlohmann::json const& j)
+{
+    std::string run_id = std::to_string(j.value("run_id", 0u));
+
+    for (auto kind : {"sim_status", "sim_time", "operation_statistics", "runs"}) {
+        if (j.contains(kind))
+            return kind + ("/" + run_id);
+    }
+
+    return {};
+}
+
+void WebsocketDataBus::messageToSession(WebsocketSession& cli, nlohmann::json const& j)
+{
+    auto encoding = cli.encoding();
+    cli.send(std::make_shared<std::string const>(encode(j, encoding)), {}, encoding != Encoding::json);
+}
+
+void WebsocketDataBus::subscribe(WebsocketSession* cli, std::vector<Topic> const& topics, bool on)
+{
+    unsigned mask = 0;
+    for (auto topic : topics) {
+        if (on && !cli->isSubscribed(topic))
+            mask |= topicBit(topic);
+        cli->subscribe(topic, on);
+    }
+
+    log(debug) << "session " << cli << (on ? " subscribed to " : " unsubscribed from ") << topics.size() << " topics";
+
+    // commands are processed on the session strand
+    if (mask)
+        sendLastValues(*cli, mask);
 }
 
-void WebsocketDataBus::messageToWebclients(std::string&& msg, bool admin_only)
+void WebsocketDataBus::setEncoding(WebsocketSession* cli, Encoding encoding)
 {
-    auto sm = std::make_shared<std::string const>(std::move(msg));
+    cli->setEncoding(encoding);
+    log(debug) << "session " << cli << " encoding " << encodingToString(encoding);
+}
 
-    std::vector<std::weak_ptr<WebsocketSession>> clients;
-    {
-        std::shared_lock lock(mtx);
-        clients.reserve(sessions_.size());
-        for_each_webclient_session([&] (auto* cli) {
-            clients.emplace_back(cli->weak_from_this());
+bool WebsocketDataBus::hasSubscribers(Topic topic) const
+{
+    auto shards = shards_.load();
+    return std::any_of(shards->begin(), shards->end(), [topic](auto const& shard) {
+        auto sessions = shard->sessions.load();
+        return std::any_of(sessions->begin(), sessions->end(), [topic](auto const& cli) {
+            return cli->isSubscribed(topic);
         });
+    });
+}
+
+std::string_view WebsocketDataBus::topicToString(Topic topic)
+{
+    return topic_names[static_cast<unsigned>(topic)];
+}
+
+Topic WebsocketDataBus::topicFromString(std::string_view str)
+{
+    // "statistics" is accepted as well as the message key
+    if (str == "statistics")
+        return Topic::statistics;
+
+    for (unsigned i = 0; i < std::size(topic_names); ++i) {
+        if (topic_names[i] == str)
+            return static_cast<Topic>(i);
+    }
+
+    throw std::runtime_error("unknown topic " + std::string(str));
+}
+
+std::optional<Topic> WebsocketDataBus::topicOf(nlohmann::json const& j)
+{
+    // status messages carry sim_time as well, they are sent to all sessions
+    if (!j.is_object() || j.contains("sim_status"))
+        return {};
+
+    for (unsigned i = 0; i < std::size(topic_names); ++i) {
+        if (j.contains(topic_names[i]))
+            return static_cast<Topic>(i);
+    }
+
+    return {};
+}
+
+std::string WebsocketDataBus::encode(nlohmann::json const& j, Encoding encoding)
+{
+    std::string result;
+
+    switch (encoding) {
+        case Encoding::cbor:
+            nlohmann::json::to_cbor(j, result);
+            break;
+        case Encoding::msgpack:
+            nlohmann::json::to_msgpack(j, result);
+            break;
+        default:
+            result = j.dump();
+            break;
+    }
+
+    return result;
+}
+
+std::string_view WebsocketDataBus::encodingToString(Encoding encoding)
+{
+    switch (encoding) {
+        case Encoding::cbor: return "cbor";
+        case Encoding::msgpack: return "msgpack";
+        default: return "json";
     }
+}
+
+Encoding WebsocketDataBus::encodingFromString(std::string_view str)
+{
+    if (str == "json")
+        return Encoding::json;
+    if (str == "cbor")
+        return Encoding::cbor;
+    if (str == "msgpack")
+        return Encoding::msgpack;
+
+    throw std::runtime_error("unknown encoding " + std::string(str));
+}
+
+WebsocketDataBus::Statistics WebsocketDataBus::statistics() const
+{
+    Statistics stat;
+    stat.sessions = countSessions();
+    stat.messages = messages_;
+    stat.payload_bytes = payload_bytes_;
+    stat.wire_bytes = wire_bytes_;
+    stat.compression_ratio = stat.wire_bytes ? static_cast<double>(stat.payload_bytes) / stat.wire_bytes : 1;
+    stat.compress_cpu_ms = compress_cpu_ns_ * 1e-6;
+    stat.dropped_sessions = dropped_sessions_;
+    return stat;
+}
 
-    for (auto& cli : clients)
-        if (auto sp = cli.lock())
-            sp->send(sm);
+void WebsocketDataBus::resetStatistics()
+{
+    messages_ = 0;
+    payload_bytes_ = 0;
+    wire_bytes_ = 0;
+    compress_cpu_ns_ = 0;
+    dropped_sessions_ = 0;
+}
+
+void WebsocketDataBus::recordWrite(size_t payload_bytes, size_t wire_bytes, double cpu_ms)
+{
+    messages_++;
+    payload_bytes_ += payload_bytes;
+    wire_bytes_ += wire_bytes;
+    compress_cpu_ns_ += static_cast<long long>(cpu_ms * 1e6);
 }
 
 size_t WebsocketDataBus::countSessions() const
 {
-    std::shared_lock lock(mtx);
-    return sessions_.size();
+    size_t n = 0;
+    for (auto const& shard : *shards_.load())
+        n += shard->sessions.load()->size();
+    return n;
 }
 
 
@@ -84,10 +347,48 @@ size_t WebsocketDataBus::countSessions() const
 //// ---------------------- (no mutex locks!)  ----------------------------
 //// ----------------------------------------------------------------------
 
-template<typename F>
-void WebsocketDataBus::for_each_webclient_session(F&& f)
+void WebsocketDataBus::publish(shard_list const& shards, std::shared_ptr<Broadcast const> b)
 {
-    for (auto& it : sessions_) {
-        f(it);
+    for (auto const& shard : shards) {
+        auto sessions = shard->sessions.load();
+        if (sessions->empty())
+            continue;
+
+        if (!shard->dispatch) {
+            for (auto const& cli : *sessions)
+                deliver(*cli, *b, false);
+            continue;
+        }
+
+        // one handler per shard, sessions of the shard share its strand
+        shard->dispatch([sessions = std::move(sessions), b] {
+            for (auto const& cli : *sessions)
+                deliver(*cli, *b, true);
+        });
     }
 }
+
+void WebsocketDataBus::deliver(WebsocketSession& cli, Broadcast const& b, bool in_strand)
+{
+    if (!accepts(cli, b.admin_only, b.topic))
+        return;
+
+    auto encoding = b.json ? cli.encoding() : Encoding::json;
+    auto msg = b.encoded[static_cast<unsigned>(encoding)];
+
+    // encoding changed after the broadcast was prepared
+    if (!msg)
+        msg = std::make_shared<std::string const>(encode(*b.json, encoding));
+
+    if (in_strand)
+        cli.sendInStrand(std::move(msg), b.key, encoding != Encoding::json);
+    else
+        cli.send(std::move(msg), b.key, encoding != Encoding::json);
+}
+
+bool WebsocketDataBus::accepts(WebsocketSession const& cli, bool admin_only, std::optional<Topic> topic)
+{
+    if (admin_only && !cli.isAdmin())
+        return false;
+    return !topic || cli.isSubscribed(*topic);
+}
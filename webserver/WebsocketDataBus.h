@@ -2,23 +2,51 @@
 #define WEBSOCKETDATABUS_H
 
 #include "Object.h"
+#include "LastValueCache.h"
 #include "nlohmann/json_fwd.hpp"
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <shared_mutex>
-#include <unordered_set>
+#include <mutex>
 
 class WebsocketSession;
 
+// Message topics clients subscribe to. A message has a topic when its top level key is the topic name,
+// messages without a topic (status, runs, history and query results) are sent to all sessions.
+enum class Topic : unsigned
+{
+    sim_time,
+    kpi_daily,
+    kpi_weekly,
+    statistics,         // operation_statistics
+    series_energy,      // raw data points of the channel (opt-in)
+    series_production
+};
+
+// Websocket message encoding of a session, binary encodings are sent as binary frames
+enum class Encoding : unsigned
+{
+    json,
+    cbor,
+    msgpack
+};
+
+constexpr unsigned encoding_count = 3;
+
+constexpr unsigned topicBit(Topic topic) { return 1u << static_cast<unsigned>(topic); }
+
 //
 // DataBus class
 //
 class WebsocketDataBus : public Object
 {
 public:
-    using session_list = std::unordered_set<WebsocketSession*>;
+    // Immutable snapshot of registered sessions
+    using session_list = std::vector<std::shared_ptr<WebsocketSession>>;
 
 private:
 
@@ -37,23 +65,143 @@ public:
 
     static WebsocketDataBus& instance();
 
-    void registerSession(WebsocketSession* cli);
+    // permessage-deflate settings of new sessions
+    struct CompressionOptions
+    {
+        bool enabled {true};
+        size_t threshold {512};     // bytes, smaller messages are not compressed
+        int level {6};              // deflate level 0..9
+    } compression;
+
+    struct Statistics
+    {
+        size_t sessions {0};
+        size_t messages {0};
+        size_t payload_bytes {0};   // message bytes
+        size_t wire_bytes {0};      // bytes written to sockets (frames)
+        double compression_ratio {1};
+        double compress_cpu_ms {0};  // frame preparation including compression
+        size_t dropped_sessions {0};
+    };
+
+    Statistics statistics() const;
+
+    void resetStatistics();
+
+    // Called by sessions on finished message write
+    void recordWrite(size_t payload_bytes, size_t wire_bytes, double cpu_ms);
+
+    void recordDrop() { dropped_sessions_++; }
+
+    // Posts a task to a broadcast shard (io_context strand)
+    using Dispatcher = std::function<void(std::function<void()>&&)>;
+
+    // Sessions are split into shards by WebsocketSession::shard(). A broadcast posts one
+    // handler per shard which fans the message out to the sessions of the shard on their
+    // common strand. Without shards messages are posted to each session.
+    void setShards(std::vector<Dispatcher>&& dispatchers);
+
+    // Registry holds the session until it is unregistered (connection closed)
+    void registerSession(std::shared_ptr<WebsocketSession> cli);
 
     void unregisterSession(WebsocketSession* cli);
 
+    // Releases all sessions and shards (webserver stopped)
+    void unregisterAll();
+
+    // Sends cached last values to a new session (topic_mask - topics the session subscribed to,
+    // messages without a topic only with all topics). Caller runs on the session strand.
+    void sendLastValues(WebsocketSession& cli, unsigned topic_mask = ~0u);
+
+    // Drops cached values of a closed simulation run
+    void forgetRun(unsigned run_id) { cache_.forgetRun(run_id); }
+
+    // Drops cached kpi and series of a restarted simulation run
+    void forgetRunResults(unsigned run_id) { cache_.forgetResults(run_id); }
+
+    // Message with a topic is serialized only if a session is subscribed to it,
+    // once for every encoding used by the receiving sessions. Updates the last value cache.
     void messageToWebclients(nlohmann::json&& j, bool admin_only=false);
 
-    void messageToWebclients(std::string&& msg, bool admin_only=false);
+    // Serialized json text message (sent as text to sessions of all encodings).
+    // Slow clients keep only the latest message of the same coalesce key (empty key - always delivered)
+    void messageToWebclients(std::string&& msg, bool admin_only=false, std::string const& coalesce_key={},
+                             std::optional<Topic> topic={});
+
+    // Reply to a single session in its encoding (thread safe, not cached)
+    void messageToSession(WebsocketSession& cli, nlohmann::json const& j);
+
+    void subscribe(WebsocketSession* cli, std::vector<Topic> const& topics, bool on);
+
+    void setEncoding(WebsocketSession* cli, Encoding encoding);
+
+    // Publishers check before building a message
+    bool hasSubscribers(Topic topic) const;
+
+    static std::string_view topicToString(Topic topic);
+
+    static Topic topicFromString(std::string_view str);
+
+    static std::optional<Topic> topicOf(nlohmann::json const& j);
+
+    static std::string encode(nlohmann::json const& j, Encoding encoding);
+
+    static std::string_view encodingToString(Encoding encoding);
+
+    static Encoding encodingFromString(std::string_view str);
+
+    // Coalesce key of latest value messages (sim_time, statistics, runs list) per run, empty for others
+    static std::string coalesceKey(nlohmann::json const& j);
 
     size_t countSessions() const;
 
 private:
 
-    template<typename F>
-    void for_each_webclient_session(F&& f);
+    // Message prepared for all shards
+    struct Broadcast
+    {
+        std::shared_ptr<std::string const> encoded[encoding_count];
+        std::shared_ptr<nlohmann::json const> json;     // empty - text message
+        std::string key;
+        bool admin_only {false};
+        std::optional<Topic> topic;
+    };
+
+    struct Shard
+    {
+        Shard() = default;
+
+        explicit Shard(Dispatcher&& d)
+            : dispatch(std::move(d))
+        {}
+
+        Dispatcher dispatch; // empty - no shard strand
+        std::atomic<std::shared_ptr<session_list const>> sessions {std::make_shared<session_list const>()};
+    };
+
+    using shard_list = std::vector<std::shared_ptr<Shard>>;
+
+    static void publish(shard_list const& shards, std::shared_ptr<Broadcast const> b);
+
+    static void deliver(WebsocketSession& cli, Broadcast const& b, bool in_strand);
+
+    // Session receives the message
+    static bool accepts(WebsocketSession const& cli, bool admin_only, std::optional<Topic> topic);
+
+    // Broadcasts read the current snapshots without locking, register / unregister
+    // (serialized by mtx) publish a modified copy
+    std::atomic<std::shared_ptr<shard_list const>> shards_ {
+        std::make_shared<shard_list const>(shard_list{std::make_shared<Shard>()})
+    };
+    std::mutex mtx;
+
+    LastValueCache cache_;
 
-    session_list sessions_;
-    std::shared_mutex mutable mtx;
+    std::atomic<size_t> messages_ {0};
+    std::atomic<size_t> payload_bytes_ {0};
+    std::atomic<size_t> wire_bytes_ {0};
+    std::atomic<long long> compress_cpu_ns_ {0};
+    std::atomic<size_t> dropped_sessions_ {0};
 };
 
 #endif // WEBSOCKETDATABUS_H
@@ -2,26 +2,53 @@
 #include "WebsocketDataBus.h"
 #include "Application.h"
 
-WebsocketSession::WebsocketSession(tcp::socket&& socket)
+#include <algorithm>
+
+WebsocketSession::WebsocketSession(tcp::socket&& socket, size_t shard)
     : Object("WebsocketSession")
     , ws_(std::move(socket))
+    , shard_(shard)
+    , subscriptions_(default_subscriptions)
 {
 }
 
 WebsocketSession::~WebsocketSession()
 {
-    WebsocketDataBus::instance().unregisterSession(this);
+    log(debug) << "session " << this << " destroyed";
 }
 
-void WebsocketSession::on_send(std::shared_ptr<const std::string> const& ss)
+void WebsocketSession::on_send(Message const& m)
 {
     log(trace) << "websocket session " << this << " - on_send thread id " << std::this_thread::get_id();
 
     // Lock mutex while pushing to the queue
     std::unique_lock lock(mtx_queue_);
 
-    // Always add to queue
-    queue_.push(ss);
+    if (closed_)
+        return;
+
+    // Replace the waiting message of the same kind (the one being written stays)
+    if (!m.key.empty() && !queue_.empty()) {
+        auto it = std::find_if(std::next(queue_.begin()), queue_.end(), [&](Message const& q) {
+            return q.key == m.key;
+        });
+
+        if (it != queue_.end()) {
+            queue_bytes_ = queue_bytes_ - it->data->size() + m.data->size();
+            it->data = m.data;
+            return;
+        }
+    }
+
+    queue_.push_back(m);
+    queue_bytes_ += m.data->size();
+
+    if (queue_.size() > max_queue_messages || queue_bytes_ > max_queue_bytes) {
+        auto reason = std::to_string(queue_.size()) + " messages / " + std::to_string(queue_bytes_) + " bytes queued";
+        lock.unlock();
+        drop(reason);
+        return;
+    }
 
     // Are we already writing?
     if (queue_.size() > 1)
@@ -30,14 +57,26 @@ void WebsocketSession::on_send(std::shared_ptr<const std::string> const& ss)
     // We don't need mutex locked here any more
     lock.unlock();
 
+    // We are not currently writing, so send this immediately
+    write_front();
+}
+
+void WebsocketSession::write_front()
+{
+    auto const& m = queue_.front();
+
     tp_send_begin_ = std::chrono::steady_clock::now();
 
-    // We are not currently writing, so send this immediately
+    // compression of the first frame is done in the initiation
+    auto& meter = ws_.next_layer();
+    meter.startCpuMeter();
+    ws_.binary(m.binary);
     ws_.async_write(
-        net::buffer(*queue_.front()),
+        net::buffer(*m.data),
         beast::bind_front_handler(
             &WebsocketSession::on_write,
             shared_from_this()));
+    meter.stopCpuMeter();
 }
 
 void WebsocketSession::on_write(beast::error_code ec, std::size_t n)
@@ -47,18 +86,23 @@ void WebsocketSession::on_write(beast::error_code ec, std::size_t n)
     // Handle the error, if any
     if (ec) {
         log(error) << "write : " << ec.message();
+        std::lock_guard lock(mtx_queue_);
+        closed_ = true; // nothing is written any more, don't queue
         return;
     }
 
     tp_send_end_ = std::chrono::steady_clock::now();
     double us = std::chrono::duration_cast<std::chrono::microseconds>(tp_send_end_ - tp_send_begin_).count();
-    log(debug) << "Websocket send finished " << n << " bytes - elapsed time " << us / 1000 << " msec";
+    auto counters = ws_.next_layer().take();
+    log(debug) << "Websocket send finished " << n << " bytes (" << counters.bytes << " on wire) - elapsed time " << us / 1000 << " msec";
+    WebsocketDataBus::instance().recordWrite(n, counters.bytes, counters.cpu_ms);
 
     // Lock mutex
     std::unique_lock lock(mtx_queue_);
 
     // Remove the string from the queue
-    queue_.pop();
+    queue_bytes_ -= queue_.front().data->size();
+    queue_.pop_front();
 
     // Send the next message if any
     if (!queue_.empty()) {
@@ -66,14 +110,8 @@ void WebsocketSession::on_write(beast::error_code ec, std::size_t n)
         // we can release mutex as no one could remove the first element from queue
         lock.unlock();
 
-        tp_send_begin_ = std::chrono::steady_clock::now();
-
         // Write next message
-        ws_.async_write(
-            net::buffer(*queue_.front()),
-            beast::bind_front_handler(
-                &WebsocketSession::on_write,
-                shared_from_this()));
+        write_front();
     }
 }
 
@@ -85,13 +123,11 @@ void WebsocketSession::on_accept(beast::error_code ec)
         return;
     }
 
-    // Add this session to the list of active sessions
-    WebsocketDataBus::instance().registerSession(this);
+    // Add this session to the list of active sessions (until the connection is closed)
+    WebsocketDataBus::instance().registerSession(shared_from_this());
 
-    // Send status message to webclient
-    std::thread([self = shared_from_this()]() {
-        self->send(std::make_shared<std::string const>(Application::instance().statusMessage()));
-    }).detach();
+    // Send status, recent kpi and series to webclient
+    WebsocketDataBus::instance().sendLastValues(*this);
 
     // Read a message
     ws_.async_read(
@@ -106,18 +142,22 @@ void WebsocketSession::on_read(beast::error_code ec, std::size_t)
     // This indicates that the websocket_session was closed
     if (ec == websocket::error::closed) {
         log(info) << "Websocket closed session " << this;
+        WebsocketDataBus::instance().unregisterSession(this);
         return;
     }
 
     if (ec) {
         log(error) << "read : " << ec.message();
+        WebsocketDataBus::instance().unregisterSession(this);
         return;
     }
 
+    // Commands run on the shard strand - blocking ones (start, stop, close_run) are
+    // posted to the control pool by the application, the read is re-armed right away
     try {
         std::string data = boost::beast::buffers_to_string(buffer_.data());
         log(debug) << "received " << data;
-        Application::instance().acceptMessage(std::move(data));
+        Application::instance().acceptMessage(std::move(data), this);
     }
     catch (std::exception& e) {
         log(error) << "websocket error : " << e.what();
@@ -134,13 +174,19 @@ void WebsocketSession::on_read(beast::error_code ec, std::size_t)
             shared_from_this()));
 }
 
-void WebsocketSession::send(std::shared_ptr<std::string const> ss)
+void WebsocketSession::send(std::shared_ptr<std::string const> ss, std::string coalesce_key, bool binary)
 {
     {
         auto lg = log(trace);
-        lg << "Websocket sending " << ss->size() << " bytes : " << ss->substr(0, 200);
-        if (ss->size() > 200) {
-            lg << " ...";
+        lg << "Websocket sending " << ss->size() << " bytes";
+        if (binary) {
+            lg << " (binary)";
+        }
+        else {
+            lg << " : " << ss->substr(0, 200);
+            if (ss->size() > 200) {
+                lg << " ...";
+            }
         }
     }
 
@@ -152,7 +198,37 @@ void WebsocketSession::send(std::shared_ptr<std::string const> ss)
         beast::bind_front_handler(
             &WebsocketSession::on_send,
             shared_from_this(),
-            ss));
+            Message{std::move(ss), std::move(coalesce_key), binary}));
+}
+
+void WebsocketSession::sendInStrand(std::shared_ptr<std::string const> ss, std::string coalesce_key, bool binary)
+{
+    on_send(Message{std::move(ss), std::move(coalesce_key), binary});
+}
+
+void WebsocketSession::drop(std::string const& reason)
+{
+    {
+        std::lock_guard lock(mtx_queue_);
+        if (closed_)
+            return;
+        closed_ = true;
+    }
+
+    log(warning) << "websocket client " << ip_address_ << " too slow (" << reason << ") - disconnecting";
+    WebsocketDataBus::instance().recordDrop();
+
+    // Pending write fails with operation_aborted, queue is released with the session
+    beast::error_code ec;
+    beast::get_lowest_layer(ws_).socket().close(ec);
+}
+
+void WebsocketSession::subscribe(Topic topic, bool on)
+{
+    if (on)
+        subscriptions_ |= topicBit(topic);
+    else
+        subscriptions_ &= ~topicBit(topic);
 }
 
 void WebsocketSession::disconnect()
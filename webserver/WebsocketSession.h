@@ -2,47 +2,128 @@
 #define WEBSOCKETSESSION_H
 
 #include "Object.h"
+#include "MeteredStream.h"
 #include "Webserver_common.h"
-#include <queue>
+#include "WebsocketDataBus.h"
+#include <atomic>
+#include <deque>
 #include <thread>
 
 
 class WebsocketSession : public Object, public std::enable_shared_from_this<WebsocketSession>
 {
-    websocket::stream<beast::tcp_stream> ws_;
+    websocket::stream<MeteredStream> ws_;
     beast::flat_buffer buffer_;
 
+    // Queued message, messages with the same coalesce key replace each other while waiting
+    struct Message
+    {
+        std::shared_ptr<std::string const> data;
+        std::string key;
+        bool binary {false};
+    };
+
     std::mutex mtx_queue_;
-    std::queue< std::shared_ptr<std::string const> > queue_;
+    std::deque<Message> queue_; // front is being written
+    size_t queue_bytes_ {0};
+    bool closed_ {false};
     std::string ip_address_;
+    size_t shard_;
+    bool admin_ {false};
+    std::atomic<unsigned> subscriptions_; // topic bit mask
+    std::atomic<Encoding> encoding_ {Encoding::json};
     std::chrono::steady_clock::time_point tp_send_begin_;
     std::chrono::steady_clock::time_point tp_send_end_;
 
-    void on_send(std::shared_ptr<std::string const> const& ss);
+    void on_send(Message const& m);
+    void write_front();
     void on_write(beast::error_code ec, std::size_t);
     void on_accept(beast::error_code ec);
     void on_read(beast::error_code ec, std::size_t);
 
+    // Closes the socket of a client that doesn't keep up (strand only)
+    void drop(std::string const& reason);
+
+    template<class Options>
+    static constexpr bool has_compression_threshold = requires(Options& pmd, size_t threshold) {
+        pmd.msg_size_threshold = threshold;
+    };
+
+    // Messages below the threshold are sent uncompressed (Boost.Beast with msg_size_threshold)
+    template<class Options>
+    static void setCompressionThreshold(Options& pmd, size_t threshold)
+    {
+        if constexpr (has_compression_threshold<Options>)
+            pmd.msg_size_threshold = threshold;
+    }
+
 public:
 
-    explicit WebsocketSession(tcp::socket&& socket);
+    // Hard limits of the send queue - a client above either limit is disconnected.
+    // Latest value messages (sim_time, status, statistics) are coalesced, so the queue only
+    // grows with messages that must be delivered (kpi, history, query results).
+    static constexpr size_t max_queue_messages = 1024;
+    static constexpr size_t max_queue_bytes = 32 * 1024 * 1024;
+
+    // Socket executor is the strand of the broadcast shard
+    explicit WebsocketSession(tcp::socket&& socket, size_t shard = 0);
 
     ~WebsocketSession() override;
 
-    void send(std::shared_ptr<std::string const> ss);
+    // Queues message to the client, a waiting message with the same coalesce key is replaced
+    // (empty key - always delivered)
+    void send(std::shared_ptr<std::string const> ss, std::string coalesce_key = {}, bool binary = false);
+
+    // Same as send, caller runs on the session strand (shard)
+    void sendInStrand(std::shared_ptr<std::string const> ss, std::string coalesce_key, bool binary);
+
+    size_t shard() const { return shard_; }
 
     void disconnect();
 
+    // Clients connected from the server host (directly or through local proxy) receive admin_only messages
+    bool isAdmin() const { return admin_; }
+
+    bool isSubscribed(Topic topic) const { return subscriptions_ & topicBit(topic); }
+
+    void subscribe(Topic topic, bool on);
+
+    Encoding encoding() const { return encoding_; }
+
+    // Messages published after the call use the encoding
+    void setEncoding(Encoding encoding) { encoding_ = encoding; }
+
+    // Boost.Beast without permessage_deflate::msg_size_threshold compresses messages of all sizes
+    static constexpr bool compression_threshold_supported = has_compression_threshold<websocket::permessage_deflate>;
+
+    // Topics of a new session (everything except raw series)
+    static constexpr unsigned default_subscriptions = topicBit(Topic::sim_time) | topicBit(Topic::kpi_daily) |
+                                                      topicBit(Topic::kpi_weekly) | topicBit(Topic::statistics);
+
     template<class Body, class Allocator>
     void run(http::request<Body, http::basic_fields<Allocator>> req, std::string ip_addr)
     {
         ip_address_ = std::move(ip_addr);
 
+        boost::system::error_code ec;
+        auto address = net::ip::make_address(ip_address_, ec);
+        admin_ = !ec && address.is_loopback();
+
         // Set suggested timeout settings for the websocket
         ws_.set_option(
                 websocket::stream_base::timeout::suggested(
                         beast::role_type::server));
 
+        // Compression is negotiated in the handshake (when the client offers it)
+        auto const& compression = WebsocketDataBus::instance().compression;
+        if (compression.enabled) {
+            websocket::permessage_deflate pmd;
+            pmd.server_enable = true;
+            pmd.compLevel = compression.level;
+            setCompressionThreshold(pmd, compression.threshold);
+            ws_.set_option(pmd);
+        }
+
         // Set a decorator to change the Server of the handshake
         ws_.set_option(websocket::stream_base::decorator(
                 [](websocket::response_type& res)